@@ -1,11 +1,127 @@
 #include "disk_emu.h"
 #include "sfs_api.h"
+#include "sfs_internal.h"
+#include "ssfs_lz.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 // some global vars
 bitmap_t free_bitmap;
-inode_t inode_table[NUM_INODES];
-file_descriptor_t file_descriptors[MAX_FD_ENTRY];
+// in memory inode cache split by field: the sizes and flags scanned by the allocator
+// and the directory code are packed together, while the block maps of an inode table
+// block are only allocated once that block is read. inode_t is the on-disk format
+int inode_sizes[NUM_INODES];
+int inode_flags[NUM_INODES];
+int inode_opens[NUM_INODES]; // descriptors open on each inode, in memory only
+inode_map_t *inode_maps[NUM_INODE_BLOCKS];
+// in memory only, rebuilt from the inode table at mount. a set bit is a used inode
+uint32_t inode_bitmap[INODE_BITMAP_WORDS];
+int inode_hint = 0; // no word below this one has a free inode
+// the fd table moves when it grows, it is only touched with fs_lock held
+file_descriptor_t *file_descriptors = NULL;
+int fd_capacity = 0;
+int fd_free_head = -1;
 super_block_t super_block;
+int read_only = 0; // set while a snapshot is mounted
+// the root directory region, kept in memory and written back a block at a time
+dirent_t root_dir[NUM_FILES];
+// summary of the name heap blocks, rebuilt at mount, and the last heap block read
+int heap_blocks = 0;
+int *heap_tail = NULL;
+int *heap_live = NULL;
+char heap_cache[BLOCK_SIZE];
+int heap_cache_block = -1;
+// metadata is read from disk on first use, a set bit marks a block held in memory
+uint32_t inode_blocks_loaded[NUM_INODE_BLOCKS / 32 + 1];
+uint32_t root_blocks_loaded[ROOT_DIR_BLOCKS / 32 + 1];
+// each inode table block as it was last read or written. a block is dirty, and written,
+// only when packing it gives something else or its image is not valid
+char inode_images[NUM_INODE_BLOCKS][BLOCK_SIZE];
+uint32_t inode_images_valid[NUM_INODE_BLOCKS / 32 + 1];
+int free_bitmap_loaded = 0;
+// number of files sharing each block beyond its first owner, written along with the free bitmap
+uint8_t block_shares[NUM_DATA_BLOCKS];
+_Static_assert(sizeof(block_shares) <= BLOCK_SIZE, "the share counts must fit in SHARES_BLOCK");
+int block_shares_loaded = 0;
+int block_shares_dirty = 0;
+// fingerprint of the data blocks written with dedup on, 0 for none. it can be stale,
+// a match is compared byte by byte before the block is shared
+uint32_t block_hashes[NUM_DATA_BLOCKS];
+int block_hashes_loaded = 0;
+uint32_t block_hashes_dirty = 0; // one bit per index block
+int hash_buckets[DEDUP_BUCKETS];
+int hash_next[NUM_DATA_BLOCKS];
+int name_heap_loaded = 0;
+// block the next packed tail is appended to and its used bytes, in memory only:
+// a new mount starts a new tail block
+int tail_block = -1;
+int tail_used = 0;
+int defrag_cursor = 0; // inode an incremental ssfs_defrag resumes at
+// blocks inside the reservation window of some descriptor, in memory only
+uint32_t reserved_bits[NUM_DATA_BLOCKS / 32];
+// counters of the measured operations and of every block transferred, see ssfs_statfs
+ssfs_op_stats_t op_stats[SSFS_STAT_NUM_OPS];
+char *stat_op_names[SSFS_STAT_NUM_OPS] = {"fopen", "fread", "fwrite", "remove", "frseek", "fwseek"};
+uint64_t disk_blocks_read = 0;
+uint64_t disk_blocks_written = 0;
+uint64_t disk_metadata_writes = 0;
+// file ssfs_stats_export appends to, NULL when not exporting
+FILE *stats_file = NULL;
+int stats_interval_ms = 0;
+uint64_t stats_next_export = 0; // monotonic time in microseconds
+// tracing, every thread records into a ring of its own. rings are pushed on trace_rings
+// with a compare and swap and never freed, so the events of a finished thread stay
+int trace_enabled = 0;
+trace_ring_t *trace_rings = NULL;
+int trace_next_tid = 1;
+__thread trace_ring_t *thread_ring = NULL;
+char *trace_exit_path = NULL; // from SSFS_TRACE, dumped at exit
+
+// async state: a submission ring drained by the workers and a completion ring
+// drained by ssfs_async_reap, both guarded by async_lock
+pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t async_submitted = PTHREAD_COND_INITIALIZER;
+pthread_cond_t async_completed = PTHREAD_COND_INITIALIZER;
+// the file system itself is not reentrant: every entry point holds fs_lock, the async
+// workers and synchronous callers alike. it is recursive, entry points call each other
+pthread_mutex_t fs_lock;
+pthread_once_t fs_lock_once = PTHREAD_ONCE_INIT;
+pthread_t async_workers[ASYNC_MAX_WORKERS];
+ssfs_sqe_t *submission_ring = NULL;
+ssfs_cqe_t *completion_ring = NULL;
+int async_depth = 0;
+int async_num_workers = 0;
+int sq_head = 0, sq_tail = 0;
+int cq_head = 0, cq_tail = 0;
+int async_in_flight = 0;
+int async_stopping = 0;
+
+// holds fs_lock until the enclosing entry point returns, on every return path
+#define FS_LOCKED() pthread_mutex_t *fs_locked __attribute__((cleanup(unlock_fs))) = lock_fs()
+
+void init_fs_lock()
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&fs_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// takes fs_lock, initialized on first use
+pthread_mutex_t *lock_fs()
+{
+    pthread_once(&fs_lock_once, init_fs_lock);
+    pthread_mutex_lock(&fs_lock);
+    return &fs_lock;
+}
+
+void unlock_fs(pthread_mutex_t **lock)
+{
+    pthread_mutex_unlock(*lock);
+}
 
 // set the k'th bit in the bit array arr
 void set_bit(uint32_t arr[], int k)
@@ -43,40 +159,293 @@ int test_bit(uint32_t arr[], int k)
         return 0; // k'th bit is 0
 }
 
+// nanoseconds on the monotonic clock
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// ring of the calling thread, allocated on its first event. NULL if out of memory
+trace_ring_t *get_thread_ring()
+{
+    if (thread_ring != NULL)
+        return thread_ring;
+
+    trace_ring_t *ring = malloc(sizeof(trace_ring_t));
+    trace_event_t *events = malloc(TRACE_RING_EVENTS * sizeof(trace_event_t));
+    if (ring == NULL || events == NULL)
+    {
+        printf("ERROR (get_thread_ring): could not allocate memory for trace ring.\n");
+        free(ring);
+        free(events);
+        trace_enabled = 0;
+        return NULL;
+    }
+    ring->events = events;
+    ring->head = 0;
+    ring->tid = __atomic_fetch_add(&trace_next_tid, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    thread_ring = ring;
+    return ring;
+}
+
+// appends an event to the calling thread's ring, overwriting the oldest once it is full
+void trace_event(const char *name, char phase, int block, int nblocks)
+{
+    trace_ring_t *ring = get_thread_ring();
+    if (ring == NULL)
+        return;
+
+    trace_event_t *event = &ring->events[ring->head % TRACE_RING_EVENTS];
+    event->ts_ns = now_ns();
+    event->name = name;
+    event->block = block;
+    event->nblocks = nblocks;
+    event->phase = phase;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// begin and end of a TRACE_SCOPE, a scope entered with tracing off records nothing
+const char *trace_scope_begin(const char *name)
+{
+    trace_event(name, 'B', -1, 0);
+    return name;
+}
+
+void trace_scope_end(const char **scope)
+{
+    if (*scope != NULL)
+        trace_event(*scope, 'E', -1, 0);
+}
+
+// turns the trace probes on or off, the recorded events are kept for ssfs_trace_dump
+void ssfs_trace(int enabled)
+{
+    trace_enabled = enabled != 0;
+}
+
+// writes the events of every thread to path in the Chrome trace event format, which
+// chrome://tracing and Perfetto load. recording pauses while the rings are read
+int ssfs_trace_dump(char *path)
+{
+    int enabled = trace_enabled;
+    int first = 1;
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL)
+    {
+        printf("ERROR (ssfs_trace_dump): could not open %s.\n", path);
+        return -1;
+    }
+
+    trace_enabled = 0;
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (trace_ring_t *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (uint64_t i = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0; i < head; i++)
+        {
+            trace_event_t *event = &ring->events[i % TRACE_RING_EVENTS];
+            fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %llu.%03llu, \"pid\": %i, \"tid\": %i",
+                    first ? "" : ",\n", event->name, event->phase, (unsigned long long)(event->ts_ns / 1000),
+                    (unsigned long long)(event->ts_ns % 1000), (int)getpid(), ring->tid);
+            if (event->nblocks > 0)
+                fprintf(file, ", \"args\": {\"block\": %i, \"nblocks\": %i}", event->block, event->nblocks);
+            fprintf(file, "}");
+            first = 0;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    trace_enabled = enabled;
+    return 0;
+}
+
+// atexit hook of SSFS_TRACE
+void dump_trace_at_exit()
+{
+    ssfs_trace_dump(trace_exit_path);
+}
+
+// reads nblocks blocks from the disk. every block transfer of the file system goes
+// through disk_read and disk_write, which keep the counters behind ssfs_statfs
+int disk_read(int start_address, int nblocks, void *buffer)
+{
+    disk_blocks_read += nblocks;
+    TRACE_BEGIN("disk_read", start_address, nblocks);
+    int ret = read_blocks(start_address, nblocks, buffer);
+    TRACE_END("disk_read");
+    return ret;
+}
+
+// writes nblocks blocks to the disk. kind is WRITE_DATA or WRITE_METADATA, the caller
+// knows which since directories, the name heap and snapshots live in the data region
+int disk_write(int start_address, int nblocks, void *buffer, int kind)
+{
+    disk_blocks_written += nblocks;
+    if (kind == WRITE_METADATA)
+        disk_metadata_writes += nblocks;
+    TRACE_BEGIN("disk_write", start_address, nblocks);
+    int ret = write_blocks(start_address, nblocks, buffer);
+    TRACE_END("disk_write");
+    return ret;
+}
+
+// kind of write the blocks of a file take, those of directories and the name heap are metadata
+int file_write_kind(int inode_index)
+{
+    return (inode_flags[inode_index] & (INODE_DIR | INODE_HEAP)) ? WRITE_METADATA : WRITE_DATA;
+}
+
+// allocates the block maps of inode table block b
+inode_map_t *alloc_inode_maps(int b)
+{
+    if (inode_maps[b] == NULL)
+    {
+        inode_maps[b] = malloc(INODES_PER_BLOCK * sizeof(inode_map_t));
+        if (inode_maps[b] == NULL)
+        {
+            printf("ERROR (alloc_inode_maps): could not allocate memory for inode maps.\n");
+            exit(-1);
+        }
+    }
+    return inode_maps[b];
+}
+
 // initialzies inode table
 void initialize_inode_table()
 {
     for (int i = 0; i < NUM_INODES; i++)
     {
-        inode_table[i].ind_pointer = -1;
-        inode_table[i].size = -1;
+        inode_map_t *map = &alloc_inode_maps(i / INODES_PER_BLOCK)[i % INODES_PER_BLOCK];
 
+        inode_sizes[i] = -1;
+        inode_flags[i] = 0;
+        map->ind_pointer = -1;
         for (int j = 0; j < NUM_POINTERS; j++)
-            inode_table[i].pointers[j] = -1;
+            map->pointers[j] = -1;
     }
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+        set_bit(inode_blocks_loaded, b);
+    memset(inode_images_valid, 0, sizeof(inode_images_valid));
+}
+
+// rebuilds the inode bitmap from the inode sizes, inodes of blocks
+// that are not loaded yet count as used until their block is read
+void rebuild_inode_bitmap()
+{
+    memset(inode_bitmap, 0, sizeof(inode_bitmap));
+    for (int i = 0; i < NUM_INODES; i++)
+        if (!test_bit(inode_blocks_loaded, i / INODES_PER_BLOCK) || inode_sizes[i] != -1)
+            set_bit(inode_bitmap, i);
+
+    // the tail of the last word does not map to any inode
+    for (int i = NUM_INODES; i < INODE_BITMAP_WORDS * 32; i++)
+        set_bit(inode_bitmap, i);
+    inode_hint = 0;
 }
 
 // initializes free bitmap
 void initialize_free_bitmap()
 {
+    free_bitmap_loaded = 1;
+    memset(block_shares, 0, sizeof(block_shares));
+    block_shares_loaded = 1;
+    block_shares_dirty = 1;
+    memset(block_hashes, 0, sizeof(block_hashes));
+    for (int i = 0; i < DEDUP_BUCKETS; i++)
+        hash_buckets[i] = -1;
+    block_hashes_loaded = 1;
+    block_hashes_dirty = (1u << DEDUP_BLOCKS) - 1;
     for (int i = 0; i < NUM_DATA_BLOCKS; i++)
         clear_bit(free_bitmap.bits, i);
 
-    for (int j = 0; j < 5; j++)
+    for (int j = 0; j < FIRST_DATA_BLOCK; j++)
         set_bit(free_bitmap.bits, j);
 }
 
+// gives back the reservation window of a descriptor
+void drop_window(int fileID)
+{
+    file_descriptor_t *fd = &file_descriptors[fileID];
+
+    for (int b = fd->window_start; b != -1 && b < fd->window_end; b++)
+        clear_bit(reserved_bits, b);
+    fd->window_start = -1;
+    fd->window_end = -1;
+}
+
+// resets a descriptor entry and pushes it on the free list
+void release_fd(int fileID)
+{
+    drop_window(fileID);
+    if (file_descriptors[fileID].inode != -1)
+        inode_opens[file_descriptors[fileID].inode]--;
+    file_descriptors[fileID].inode = -1;
+    file_descriptors[fileID].write_pointer = 0;
+    file_descriptors[fileID].read_pointer = 0;
+    file_descriptors[fileID].map = NULL;
+    file_descriptors[fileID].map_dirty = NULL;
+    file_descriptors[fileID].map_flags = 0;
+    file_descriptors[fileID].map_blocks = 0;
+    file_descriptors[fileID].next_free = fd_free_head;
+    fd_free_head = fileID;
+}
+
+// grows the fd table to new_capacity entries, new entries are put on the free
+// list so that the lowest index is handed out first. the caller holds fs_lock, the
+// realloc invalidates any file_descriptor_t pointer taken before it
+int grow_fd_table(int new_capacity)
+{
+    file_descriptor_t *table = realloc(file_descriptors, new_capacity * sizeof(file_descriptor_t));
+    if (table == NULL)
+    {
+        printf("ERROR (grow_fd_table): could not allocate memory for fd table.\n");
+        return -1;
+    }
+    file_descriptors = table;
+
+    for (int i = new_capacity - 1; i >= fd_capacity; i--)
+    {
+        file_descriptors[i].window_start = -1;
+        file_descriptors[i].inode = -1;
+        release_fd(i);
+    }
+    fd_capacity = new_capacity;
+    return 0;
+}
+
 // initializes fd table
 void initialize_fd_table()
 {
-    // initialize the file descriptor fd_table
-    for (int i = 0; i < MAX_FD_ENTRY; i++)
+    // mappings from a previous mount are dropped without write back
+    for (int i = 0; i < fd_capacity; i++)
     {
-        memset(file_descriptors[i].name, 0, sizeof(file_descriptors[i].name));
-        file_descriptors[i].inode = -1;
-        file_descriptors[i].write_pointer = 0;
-        file_descriptors[i].read_pointer = 0;
+        free(file_descriptors[i].map);
+        free(file_descriptors[i].map_dirty);
     }
+    free(file_descriptors);
+    file_descriptors = NULL;
+    fd_capacity = 0;
+    fd_free_head = -1;
+    memset(reserved_bits, 0, sizeof(reserved_bits));
+    memset(inode_opens, 0, sizeof(inode_opens));
+
+    // initialize the file descriptor fd_table
+    if (grow_fd_table(FD_TABLE_INITIAL) < 0)
+        exit(-1);
+}
+
+// gets the inode of an open descriptor, -1 for an out of range or closed one
+int get_fd_inode(int fileID)
+{
+    if (fileID < 0 || fileID >= fd_capacity)
+        return -1;
+    return file_descriptors[fileID].inode;
 }
 
 // initializes super block
@@ -85,731 +454,3950 @@ void initialize_super_block()
     super_block.block_size = BLOCK_SIZE;
     super_block.id = MAGIC_NUM;
     super_block.num_blocks = NUM_BLOCKS;
+    super_block.num_inodes = NUM_INODES;
+    super_block.inode_start = 1;
+    super_block.root_start = ROOT_DIR_START;
+    super_block.root_blocks = ROOT_DIR_BLOCKS;
+    for (int i = 0; i < MAX_SNAPSHOTS; i++)
+        super_block.snapshots[i] = -1;
+    super_block.dedup = 0;
+}
+
+// initializes the root directory region
+void initialize_root_dir()
+{
     for (int i = 0; i < NUM_FILES; i++)
-        super_block.root[i].inode = -1;
+    {
+        memset(&root_dir[i], 0, sizeof(dirent_t));
+        root_dir[i].inode = DIRENT_EMPTY;
+    }
+    for (int b = 0; b < ROOT_DIR_BLOCKS; b++)
+        set_bit(root_blocks_loaded, b);
 }
 
-// writes the inode table to disk
-int write_inode_table()
+// number of inodes stored in inode table block b, the last block is not full
+int inodes_in_block(int b)
 {
-    void *buffer = malloc(NUM_INODE_BLOCKS * BLOCK_SIZE);
-    if (buffer == NULL)
+    int first = b * INODES_PER_BLOCK;
+    return NUM_INODES - first < INODES_PER_BLOCK ? NUM_INODES - first : INODES_PER_BLOCK;
+}
+
+// converts inode table block b from the on-disk format into the inode cache
+void unpack_inode_block(int b, inode_t *disk)
+{
+    inode_map_t *maps = alloc_inode_maps(b);
+
+    for (int i = 0; i < inodes_in_block(b); i++)
     {
-        printf("ERROR (write_inode_table): could not allocate memory for buffer.\n");
-        return -1;
+        inode_sizes[b * INODES_PER_BLOCK + i] = disk[i].size;
+        inode_flags[b * INODES_PER_BLOCK + i] = disk[i].flags;
+        maps[i].ind_pointer = disk[i].ind_pointer;
+        memcpy(maps[i].data, disk[i].data, INLINE_MAX_SIZE);
     }
-    memset(buffer, 0, NUM_INODE_BLOCKS * BLOCK_SIZE);
-    memcpy(buffer, &inode_table, sizeof(inode_table));
-    write_blocks(1, NUM_INODE_BLOCKS, buffer);
-    free(buffer);
-    return 0;
+    set_bit(inode_blocks_loaded, b);
+    memcpy(inode_images[b], disk, BLOCK_SIZE);
+    set_bit(inode_images_valid, b);
 }
 
-// writes free bitmap to disk
-void write_free_bitmap()
+// converts inode table block b from the inode cache into the on-disk format
+void pack_inode_block(int b, inode_t *disk)
 {
-    void *buffer = malloc(BLOCK_SIZE);
-    if (buffer == NULL)
+    for (int i = 0; i < inodes_in_block(b); i++)
     {
-        printf("ERROR (write_free_bitmap): could not allocate memory for buffer.\n");
-        exit(-1);
+        disk[i].size = inode_sizes[b * INODES_PER_BLOCK + i];
+        disk[i].flags = inode_flags[b * INODES_PER_BLOCK + i];
+        disk[i].ind_pointer = inode_maps[b][i].ind_pointer;
+        memcpy(disk[i].data, inode_maps[b][i].data, INLINE_MAX_SIZE);
     }
-    memset(buffer, 0, sizeof(bitmap_t));
-    memcpy(buffer, &free_bitmap, sizeof(free_bitmap));
-    write_blocks(NUM_BLOCKS - 1, 1, buffer);
-    free(buffer);
 }
 
-// writes the super block to the disk
-void write_super_block()
+// packs inode table block b into buffer and tells whether it differs from what is on disk
+int inode_block_dirty(int b, char *buffer)
 {
-    void *buffer = malloc(BLOCK_SIZE);
+    memset(buffer, 0, BLOCK_SIZE);
+    pack_inode_block(b, (inode_t *)buffer);
+    return !test_bit(inode_images_valid, b) || memcmp(buffer, inode_images[b], BLOCK_SIZE) != 0;
+}
+
+// writes the dirty blocks of the inode table to disk, one write per run of them
+int write_inode_table()
+{
+    TRACE_SCOPE("write_inode_table");
+    uint32_t dirty[NUM_INODE_BLOCKS / 32 + 1] = {0};
+    char *buffer = malloc(NUM_INODE_BLOCKS * BLOCK_SIZE);
     if (buffer == NULL)
     {
-        printf("ERROR (write_super_block): could not allocate memory for buffer.\n");
-        exit(-1);
+        printf("ERROR (write_inode_table): could not allocate memory for buffer.\n");
+        return -1;
+    }
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+        if (test_bit(inode_blocks_loaded, b) && inode_block_dirty(b, buffer + b * BLOCK_SIZE))
+            set_bit(dirty, b);
+
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+    {
+        int run = 0;
+        while (b + run < NUM_INODE_BLOCKS && test_bit(dirty, b + run))
+        {
+            memcpy(inode_images[b + run], buffer + (b + run) * BLOCK_SIZE, BLOCK_SIZE);
+            set_bit(inode_images_valid, b + run);
+            run++;
+        }
+        if (run > 0)
+            disk_write(super_block.inode_start + b, run, buffer + b * BLOCK_SIZE, WRITE_METADATA);
+        b += run;
     }
-    memset(buffer, 0, BLOCK_SIZE);
-    memcpy(buffer, &super_block, sizeof(super_block));
-    write_blocks(0, 1, buffer);
     free(buffer);
+    return 0;
 }
 
-// gets a index of block containing file at specific location
-int get_block(inode_t node, int loc)
+// writes the inode table block holding one inode, enough when no other inode changed
+void write_inode(int inode_index)
 {
-    int pointer_index = loc / BLOCK_SIZE;
-
-    if (pointer_index >= NUM_POINTERS)
-        return get_block(inode_table[node.ind_pointer], loc - NUM_POINTERS * BLOCK_SIZE);
+    TRACE_SCOPE("write_inode");
+    char buffer[BLOCK_SIZE];
+    int b = inode_index / INODES_PER_BLOCK;
 
-    return node.pointers[pointer_index];
+    if (!inode_block_dirty(b, buffer))
+        return;
+    memcpy(inode_images[b], buffer, BLOCK_SIZE);
+    set_bit(inode_images_valid, b);
+    disk_write(super_block.inode_start + b, 1, buffer, WRITE_METADATA);
 }
 
-// gets first unsused block index from free bitmap
-int get_free_bit()
+// reads the whole inode table from disk
+int read_inode_table()
 {
-    for (int i = 0; i < NUM_DATA_BLOCKS; i++)
-        if (test_bit(free_bitmap.bits, i) == 0)
-            return i;
-
-    return -1;
+    char *buffer = malloc(NUM_INODE_BLOCKS * BLOCK_SIZE);
+    if (buffer == NULL)
+    {
+        printf("ERROR (read_inode_table): could not allocate memory for buffer.\n");
+        return -1;
+    }
+    disk_read(super_block.inode_start, NUM_INODE_BLOCKS, buffer);
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+        unpack_inode_block(b, (inode_t *)(buffer + b * BLOCK_SIZE));
+    free(buffer);
+    return 0;
 }
 
-// gets index from root directory
-int get_file_index(char *name)
+// reads inode table block b and marks its free inodes in the inode bitmap
+void load_inode_block(int b)
 {
+    inode_t buffer[BLOCK_SIZE / sizeof(inode_t)];
 
-    int name_len = strlen(name);
-    if (name_len > MAX_FILENAME - 1)
-        name_len = MAX_FILENAME - 1;
-    for (int i = 0; i < NUM_FILES; i++)
+    disk_read(super_block.inode_start + b, 1, buffer);
+    unpack_inode_block(b, buffer);
+
+    for (int i = b * INODES_PER_BLOCK; i < b * INODES_PER_BLOCK + inodes_in_block(b); i++)
     {
-        if (super_block.root[i].name[0] != '\0')
+        if (inode_sizes[i] == -1)
         {
-            //printf("get_file_index(%s): super_block.root[i].name = %s\n", super_block.root[i].name);
-            if (strncmp(name, super_block.root[i].name, name_len) == 0)
-                return i;
+            clear_bit(inode_bitmap, i);
+            if (i / 32 < inode_hint)
+                inode_hint = i / 32;
         }
     }
-
-    return -1;
 }
 
-// gets first unsused block index from free bitmap
-int get_unused_block()
+// makes sure the block of an inode is in the inode cache, returns inode_index
+int load_inode(int inode_index)
 {
-    for (int i = 0; i < NUM_DATA_BLOCKS; i++)
-        if (test_bit(free_bitmap.bits, i) == 0)
-            return i;
-
-    return -1;
+    if (!test_bit(inode_blocks_loaded, inode_index / INODES_PER_BLOCK))
+        load_inode_block(inode_index / INODES_PER_BLOCK);
+    return inode_index;
 }
 
-// gets an unused inode
-int get_unused_inode()
+// gets the block map of an inode, reading its block of the inode table on first use
+inode_map_t *get_inode_map(int inode_index)
 {
-    for (int i = 0; i < NUM_INODES; i++)
-        if (inode_table[i].size == -1)
-            return i;
-
-    return -1;
+    load_inode(inode_index);
+    return &inode_maps[inode_index / INODES_PER_BLOCK][inode_index % INODES_PER_BLOCK];
 }
 
-int get_unused_fd()
+// gets the free bitmap, reading it on first use
+uint32_t *free_bits()
 {
-    for (int i = 0; i < MAX_FD_ENTRY; i++)
-        if (file_descriptors[i].inode == -1)
-            return i;
-
-    return -1;
+    if (!free_bitmap_loaded)
+    {
+        disk_read(NUM_BLOCKS - 1, 1, &free_bitmap);
+        free_bitmap_loaded = 1;
+    }
+    return free_bitmap.bits;
 }
 
-int get_unused_dir_slot()
+// gets the share counts of the blocks, reading them on first use
+uint8_t *get_block_shares()
 {
-    for (int i = 0; i < NUM_FILES; i++)
-        if (super_block.root[i].inode == -1)
-            return i;
-
-    return -1;
+    if (!block_shares_loaded)
+    {
+        char buffer[BLOCK_SIZE];
+        disk_read(SHARES_BLOCK, 1, buffer);
+        memcpy(block_shares, buffer, sizeof(block_shares));
+        block_shares_loaded = 1;
+    }
+    return block_shares;
 }
 
-// gets the index of the inode pointing to the file's data at a specific location
-int get_file_inode_index(int node_index, int loc)
+// reads the block fingerprints on first use and chains the blocks by bucket
+uint32_t *get_block_hashes()
 {
-    int pointer_index = loc / BLOCK_SIZE;
-
-    if (pointer_index >= NUM_POINTERS)
+    if (!block_hashes_loaded)
     {
-        if (inode_table[node_index].ind_pointer == -1)
+        disk_read(DEDUP_START, DEDUP_BLOCKS, block_hashes);
+        for (int i = 0; i < DEDUP_BUCKETS; i++)
+            hash_buckets[i] = -1;
+        for (int b = 0; b < NUM_DATA_BLOCKS; b++)
         {
-            printf("ERROR (get_file_inode_index): recursion led to unitialized indirect pointer.\n");
-            return -1;
+            if (block_hashes[b] == 0)
+                continue;
+            hash_next[b] = hash_buckets[block_hashes[b] % DEDUP_BUCKETS];
+            hash_buckets[block_hashes[b] % DEDUP_BUCKETS] = b;
         }
-        else
-            return get_file_inode_index(inode_table[node_index].ind_pointer, loc - NUM_POINTERS * BLOCK_SIZE);
+        block_hashes_loaded = 1;
     }
-    else
-        return node_index;
+    return block_hashes;
 }
 
-// either initializes a new disk or loads an existing one depending on fresh
-void mkssfs(int fresh)
+// fingerprint of a block. four independent lanes of 8 byte words, so the loop
+// vectorizes, folded together at the end. never 0, that marks a block without one
+uint32_t hash_block(const char *data)
 {
+    uint64_t lanes[4] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull};
+    uint64_t h = 0;
 
-    // initialize the disk
-    if (fresh == 1)
+    for (int i = 0; i < BLOCK_SIZE; i += 4 * sizeof(uint64_t))
     {
-
-        if (init_fresh_disk(NAME, BLOCK_SIZE, NUM_BLOCKS) != 0)
+        for (int l = 0; l < 4; l++)
         {
-            printf("Error (mkssfs): could not create disk.\n");
-            exit(-1);
+            uint64_t word;
+            memcpy(&word, data + i + l * sizeof(uint64_t), sizeof(word));
+            lanes[l] = (lanes[l] ^ word) * 0x9E3779B97F4A7C15ull;
+            lanes[l] ^= lanes[l] >> 29;
         }
-
-        // initialize and write the super block
-        initialize_super_block();
-        write_super_block();
-        // initialzie and write the inode table
-        initialize_inode_table();
-        write_inode_table();
-        // initialize and write the free bitmap
-        initialize_free_bitmap();
-        write_free_bitmap();
-        // initialize the file descriptor table
-        initialize_fd_table();
     }
-    // get existing disk
-    else
-    {
-        if (init_disk(NAME, BLOCK_SIZE, NUM_BLOCKS) != 0)
-        {
-            printf("Error (mkssfs): could not create disk.\n");
-            exit(-1);
-        }
+    for (int l = 0; l < 4; l++)
+        h = (h ^ lanes[l]) * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 32;
+    return (uint32_t)h != 0 ? (uint32_t)h : 1;
+}
 
-        // read the super block, inode table, and free bitmap from the disk
-        read_blocks(0, 1, &super_block);
-        read_blocks(1, 4, &inode_table);
-        read_blocks(NUM_BLOCKS - 1, 1, &free_bitmap);
-        // initialize the file descriptor table
-        initialize_fd_table();
-    }
+// drops the fingerprint of a block
+void dedup_forget(int block_index)
+{
+    uint32_t hash = get_block_hashes()[block_index];
+    if (hash == 0)
+        return;
+
+    int *link = &hash_buckets[hash % DEDUP_BUCKETS];
+    while (*link != block_index)
+        link = &hash_next[*link];
+    *link = hash_next[block_index];
+    block_hashes[block_index] = 0;
+    block_hashes_dirty |= 1u << (block_index / HASHES_PER_BLOCK);
 }
 
-int ssfs_fopen(char *name)
+// records the fingerprint of a block just written
+void dedup_record(int block_index, uint32_t hash)
 {
-    // no change from removing this 
-    // for (int i = 0; i < MAX_FD_ENTRY; i++)
-    //     if (strcmp(file_descriptors[i].name, name) == 0)
-    //         return i;
+    if (get_block_hashes()[block_index] == hash)
+        return;
+    dedup_forget(block_index);
+    block_hashes[block_index] = hash;
+    hash_next[block_index] = hash_buckets[hash % DEDUP_BUCKETS];
+    hash_buckets[hash % DEDUP_BUCKETS] = block_index;
+    block_hashes_dirty |= 1u << (block_index / HASHES_PER_BLOCK);
+}
 
-    int directory_index = -1;
-    int fd_index;
-    int inode_index;
+// finds a block in use holding exactly data that can take another owner, -1 if none
+int dedup_find(const char *data, uint32_t hash)
+{
+    TRACE_SCOPE("dedup_find");
+    char block[BLOCK_SIZE];
 
-    // get an unsused file descriptor slot
-    fd_index = get_unused_fd();
-    if (fd_index == -1)
+    get_block_hashes();
+    for (int b = hash_buckets[hash % DEDUP_BUCKETS]; b != -1; b = hash_next[b])
     {
-        printf("ERROR (ssfs_open): already at maximum amount of file descriptors.\n");
-        return -1;
+        if (block_hashes[b] != hash || !test_bit(free_bits(), b) || get_block_shares()[b] == MAX_BLOCK_SHARES)
+            continue;
+        disk_read(b, 1, block);
+        if (memcmp(block, data, BLOCK_SIZE) == 0)
+            return b;
     }
-    // printf("fopen(): fd_index = %i\n", fd_index);
-    // printf("fopen(): name = %s\n", name);
+    return -1;
+}
 
-    // get the directory index of the file if it already exists
-    int name_len = strlen(name);
-    if (name_len > MAX_FILENAME - 1)
-        name_len = MAX_FILENAME - 1;
-    for (int i = 0; i < NUM_FILES; i++)
+// reads block b of the root directory region on first use
+void load_root_block(int b)
+{
+    if (!test_bit(root_blocks_loaded, b))
+    {
+        disk_read(super_block.root_start + b, 1, &root_dir[b * DIRENTS_PER_BLOCK]);
+        set_bit(root_blocks_loaded, b);
+    }
+}
+
+// reads every block of the root directory region that is not loaded yet
+void load_root_dir()
+{
+    for (int b = 0; b < ROOT_DIR_BLOCKS; b++)
+        load_root_block(b);
+}
+
+// writes the blocks of the fingerprint index that changed
+void write_block_hashes()
+{
+    TRACE_SCOPE("write_block_hashes");
+    for (int b = 0; b < DEDUP_BLOCKS; b++)
+        if (block_hashes_dirty & (1u << b))
+            disk_write(DEDUP_START + b, 1, &block_hashes[b * HASHES_PER_BLOCK], WRITE_METADATA);
+    block_hashes_dirty = 0;
+}
+
+// writes free bitmap to disk
+void write_free_bitmap()
+{
+    TRACE_SCOPE("write_free_bitmap");
+    // an unread bitmap has no changes to write, but the share counts and fingerprints
+    // change without it, e.g. in ssfs_clone on a lazy mount, so they are checked apart
+    if (free_bitmap_loaded)
     {
-        // names are not getting copied over
-        if (super_block.root[i].name[0] != '\0')
+        void *buffer = malloc(BLOCK_SIZE);
+        if (buffer == NULL)
         {
-            // printf("fopen(): super_block.root[i].name = %s\n", super_block.root[i].name);
-            if (strncmp(name, super_block.root[i].name, name_len) == 0)
-                directory_index = i;
+            printf("ERROR (write_free_bitmap): could not allocate memory for buffer.\n");
+            exit(-1);
         }
+        memset(buffer, 0, sizeof(bitmap_t));
+        memcpy(buffer, &free_bitmap, sizeof(free_bitmap));
+        disk_write(NUM_BLOCKS - 1, 1, buffer, WRITE_METADATA);
+        free(buffer);
     }
 
-    // check to see if the file already exits in the directory
-    if (directory_index < 0 || super_block.root[directory_index].inode == -1)
+    if (block_shares_dirty)
+    {
+        char buffer[BLOCK_SIZE] = {0};
+        memcpy(buffer, block_shares, sizeof(block_shares));
+        disk_write(SHARES_BLOCK, 1, buffer, WRITE_METADATA);
+        block_shares_dirty = 0;
+    }
+    write_block_hashes();
+}
+
+// writes the super block to the disk
+void write_super_block()
+{
+    void *buffer = malloc(BLOCK_SIZE);
+    if (buffer == NULL)
+    {
+        printf("ERROR (write_super_block): could not allocate memory for buffer.\n");
+        exit(-1);
+    }
+    memset(buffer, 0, BLOCK_SIZE);
+    memcpy(buffer, &super_block, sizeof(super_block));
+    disk_write(0, 1, buffer, WRITE_METADATA);
+    free(buffer);
+}
+
+// reads the super block from disk
+void read_super_block()
+{
+    void *buffer = malloc(BLOCK_SIZE);
+    if (buffer == NULL)
+    {
+        printf("ERROR (read_super_block): could not allocate memory for buffer.\n");
+        exit(-1);
+    }
+    disk_read(0, 1, buffer);
+    memcpy(&super_block, buffer, sizeof(super_block));
+    free(buffer);
+}
+
+// gets a index of block containing file at specific location
+int get_block(int inode_index, int loc)
+{
+    int pointer_index = loc / BLOCK_SIZE;
+    inode_map_t *map = get_inode_map(inode_index);
+
+    if (pointer_index >= NUM_POINTERS)
+    {
+        if (map->ind_pointer == -1)
+            return -1;
+        return get_block(map->ind_pointer, loc - NUM_POINTERS * BLOCK_SIZE);
+    }
+
+    return map->pointers[pointer_index];
+}
+
+// gets first unsused block index from free bitmap
+int get_free_bit()
+{
+    for (int i = 0; i < NUM_DATA_BLOCKS; i++)
+        if (test_bit(free_bits(), i) == 0)
+            return i;
+
+    return -1;
+}
+
+// gets the first free block outside every reservation window, a reserved block is
+// only handed out once no other one is free
+int get_unused_block()
+{
+    for (int i = 0; i < NUM_DATA_BLOCKS; i++)
+        if (test_bit(free_bits(), i) == 0 && !test_bit(reserved_bits, i))
+            return i;
+    for (int i = 0; i < NUM_DATA_BLOCKS; i++)
+        if (test_bit(free_bits(), i) == 0)
+            return i;
+
+    return -1;
+}
+
+// claims an unused inode, scanning the inode bitmap a word at a time from the hint.
+// the caller sets its size
+int get_unused_inode()
+{
+    while (1)
+    {
+        for (int i = inode_hint; i < INODE_BITMAP_WORDS; i++)
+        {
+            if (inode_bitmap[i] != 0xFFFFFFFF)
+            {
+                int inode_index = i * 32 + __builtin_ctz(~inode_bitmap[i]);
+                set_bit(inode_bitmap, inode_index);
+                inode_hint = i;
+                return inode_index;
+            }
+        }
+        inode_hint = INODE_BITMAP_WORDS;
+
+        // after a lazy mount the free inodes may sit in a block not read yet
+        int b = 0;
+        while (b < NUM_INODE_BLOCKS && test_bit(inode_blocks_loaded, b))
+            b++;
+        if (b == NUM_INODE_BLOCKS)
+            return -1;
+        load_inode_block(b);
+    }
+}
+
+// gives an inode back to the inode bitmap
+void release_inode(int inode_index)
+{
+    inode_sizes[load_inode(inode_index)] = -1;
+    get_inode_map(inode_index)->ind_pointer = -1;
+    // an inline file leaves its bytes where the next owner expects an empty block map
+    for (int j = 0; j < NUM_POINTERS; j++)
+        get_inode_map(inode_index)->pointers[j] = -1;
+    inode_flags[load_inode(inode_index)] = 0;
+    clear_bit(inode_bitmap, inode_index);
+    if (inode_index / 32 < inode_hint)
+        inode_hint = inode_index / 32;
+}
+
+// pops an entry off the fd free list, doubling the table when it runs out
+int get_unused_fd()
+{
+    int fileID;
+
+    if (fd_free_head == -1)
+    {
+        if (fd_capacity >= MAX_FD_ENTRY)
+            return -1;
+        if (grow_fd_table(fd_capacity * 2 > MAX_FD_ENTRY ? MAX_FD_ENTRY : fd_capacity * 2) < 0)
+            return -1;
+    }
+
+    fileID = fd_free_head;
+    fd_free_head = file_descriptors[fileID].next_free;
+    file_descriptors[fileID].next_free = -1;
+    return fileID;
+}
+
+// gets the index of the inode pointing to the file's data at a specific location
+int get_file_inode_index(int node_index, int loc)
+{
+    int pointer_index = loc / BLOCK_SIZE;
+
+    if (pointer_index >= NUM_POINTERS)
+    {
+        if (get_inode_map(node_index)->ind_pointer == -1)
+        {
+            printf("ERROR (get_file_inode_index): recursion led to unitialized indirect pointer.\n");
+            return -1;
+        }
+        else
+            return get_file_inode_index(get_inode_map(node_index)->ind_pointer, loc - NUM_POINTERS * BLOCK_SIZE);
+    }
+    else
+        return node_index;
+}
+
+// gets the inode of a file's chain holding the file block file_block,
+// indirect inodes are created on the way when alloc is set
+int get_chain_inode(int inode_index, int file_block, int alloc)
+{
+    while (file_block >= NUM_POINTERS)
+    {
+        if (get_inode_map(inode_index)->ind_pointer == -1)
+        {
+            if (!alloc)
+                return -1;
+
+            int ind_inode_index = get_unused_inode();
+            if (ind_inode_index < 0)
+            {
+                printf("ERROR (get_chain_inode): could not find an empty inode for new indirect pointer.\n");
+                return -1;
+            }
+            inode_sizes[load_inode(ind_inode_index)] = 0;
+            inode_flags[load_inode(ind_inode_index)] = 0;
+            get_inode_map(inode_index)->ind_pointer = ind_inode_index;
+        }
+        inode_index = get_inode_map(inode_index)->ind_pointer;
+        file_block -= NUM_POINTERS;
+    }
+
+    return inode_index;
+}
+
+// first free block outside every reservation window but fileID's own, any free block
+// once there is none left
+int first_fit_block(int fileID)
+{
+    file_descriptor_t *fd = fileID >= 0 ? &file_descriptors[fileID] : NULL;
+
+    for (int i = 0; i < NUM_DATA_BLOCKS; i++)
+    {
+        if (test_bit(free_bits(), i))
+            continue;
+        if (!test_bit(reserved_bits, i) || (fd != NULL && i >= fd->window_start && i < fd->window_end))
+            return i;
+    }
+    return get_unused_block();
+}
+
+// reserves ALLOC_WINDOW free blocks for the writes of fileID, at goal when they are
+// free there and otherwise at the first such run after it. returns the window start
+int reserve_window(int fileID, int goal)
+{
+    int run = 0;
+
+    if (goal < 0 || goal >= NUM_DATA_BLOCKS)
+        goal = 0;
+    for (int n = 0; n < NUM_DATA_BLOCKS; n++)
+    {
+        int b = (goal + n) % NUM_DATA_BLOCKS;
+        if (b == 0)
+            run = 0;
+        if (test_bit(free_bits(), b) || test_bit(reserved_bits, b))
+        {
+            run = 0;
+            continue;
+        }
+        if (++run < ALLOC_WINDOW)
+            continue;
+
+        drop_window(fileID);
+        file_descriptors[fileID].window_start = b - ALLOC_WINDOW + 1;
+        file_descriptors[fileID].window_end = b + 1;
+        for (int k = b - ALLOC_WINDOW + 1; k <= b; k++)
+            set_bit(reserved_bits, k);
+        return b - ALLOC_WINDOW + 1;
+    }
+    return -1;
+}
+
+// picks a free block for file block file_block. the goal is the block right after
+// the one before it in the file, so a file grows in place. a write through a descriptor
+// (fileID >= 0) takes its blocks out of the descriptor's reservation window, reserving
+// a new one at the goal when the goal leaves it, so writers appending to different
+// files at once do not interleave. first fit is the fallback when nothing is left
+int alloc_block(int inode_index, int file_block, int fileID)
+{
+    TRACE_SCOPE("alloc_block");
+    int goal = -1;
+
+    if (file_block > 0)
+    {
+        int prev = get_block(inode_index, (file_block - 1) * BLOCK_SIZE);
+        if (prev != -1 && prev + 1 < NUM_DATA_BLOCKS)
+            goal = prev + 1;
+    }
+
+    if (fileID < 0)
+    {
+        if (goal != -1 && !test_bit(free_bits(), goal) && !test_bit(reserved_bits, goal))
+            return goal;
+        return first_fit_block(-1);
+    }
+
+    // continue in the window while the goal is inside it
+    file_descriptor_t *fd = &file_descriptors[fileID];
+    if (fd->window_start != -1 && (goal == -1 || (goal >= fd->window_start && goal < fd->window_end)))
+    {
+        for (int b = goal == -1 ? fd->window_start : goal; b < fd->window_end; b++)
+            if (!test_bit(free_bits(), b))
+                return b;
+    }
+
+    int start = reserve_window(fileID, goal);
+    if (start != -1)
+        return start;
+    drop_window(fileID);
+    return first_fit_block(fileID);
+}
+
+// map_block for a write through fileID, a new block comes out of its reservation window
+int map_block_window(int inode_index, int file_block, int fileID, int *allocated)
+{
+    int node_index = get_chain_inode(inode_index, file_block, 1);
+    if (node_index < 0)
+        return -1;
+
+    int *pointer = &get_inode_map(node_index)->pointers[file_block % NUM_POINTERS];
+    if (*pointer == -1)
+    {
+        int block_index = alloc_block(inode_index, file_block, fileID);
+        if (block_index == -1)
+            return -1;
+        set_bit(free_bits(), block_index);
+        *pointer = block_index;
+        if (allocated != NULL)
+            *allocated = 1;
+    }
+
+    return *pointer;
+}
+
+// gets the disk block backing file block file_block, allocating it when alloc is set.
+// only the in memory inode table and bitmap are updated, *allocated tells the
+// caller that they need to be flushed
+int map_block(int inode_index, int file_block, int alloc, int *allocated)
+{
+    if (alloc)
+        return map_block_window(inode_index, file_block, -1, allocated);
+
+    int node_index = get_chain_inode(inode_index, file_block, 0);
+    if (node_index < 0)
+        return -1;
+    return get_inode_map(node_index)->pointers[file_block % NUM_POINTERS];
+}
+
+// drops one owner of a block, the block is only freed once its last owner lets go
+void release_block(int block_index)
+{
+    if (get_block_shares()[block_index] > 0)
+    {
+        block_shares[block_index]--;
+        block_shares_dirty = 1;
+    }
+    else
+    {
+        clear_bit(free_bits(), block_index);
+        dedup_forget(block_index);
+        if (block_index == tail_block)
+            tail_block = -1;
+    }
+}
+
+// gives a file its own block in place of a shared one before the block is written and
+// returns the block to write to. nothing is copied: a caller keeping part of the old
+// data reads it from block_index first. only memory is updated, the caller flushes
+int unshare_block(int inode_index, int file_block, int block_index)
+{
+    TRACE_SCOPE("unshare_block");
+    if (get_block_shares()[block_index] == 0)
+        return block_index;
+
+    int new_index = get_unused_block();
+    if (new_index == -1)
+    {
+        printf("ERROR (unshare_block): could not find an empty block.\n");
+        return -1;
+    }
+    set_bit(free_bits(), new_index);
+    block_shares[block_index]--;
+    block_shares_dirty = 1;
+
+    int node_index = get_chain_inode(inode_index, file_block, 0);
+    get_inode_map(node_index)->pointers[file_block % NUM_POINTERS] = new_index;
+    return new_index;
+}
+
+// writes one block of a file in place, a shared block is replaced by a private one first
+int write_file_block(int inode_index, int file_block, void *data)
+{
+    int block_index = map_block(inode_index, file_block, 0, NULL);
+    if (block_index == -1)
+        return -1;
+
+    int target_index = unshare_block(inode_index, file_block, block_index);
+    if (target_index == -1)
+        return -1;
+    if (target_index != block_index)
+    {
+        write_free_bitmap();
+        write_inode_table();
+    }
+    disk_write(target_index, 1, data, file_write_kind(inode_index));
+    return 0;
+}
+
+// releases every block of a file from file block first_block on, along with
+// the indirect inodes left without any block. only the in memory inode table
+// and bitmap are updated, the caller flushes them
+void free_file_blocks(int inode_index, int first_block)
+{
+    int node_index = inode_index;
+    int prev_index = -1;
+    int base = 0;
+
+    // an inline file owns no blocks
+    if (inode_flags[load_inode(inode_index)] & INODE_INLINE)
+        return;
+
+    // a packed tail is one owner of its tail block
+    if ((inode_flags[inode_index] & INODE_TAIL) && first_block <= inode_sizes[inode_index] / BLOCK_SIZE)
+    {
+        release_block(get_inode_map(inode_index)->tail_block);
+        inode_flags[inode_index] &= ~INODE_TAIL;
+    }
+
+    while (node_index != -1)
+    {
+        int next_index = get_inode_map(node_index)->ind_pointer;
+
+        for (int i = 0; i < NUM_POINTERS; i++)
+        {
+            if (base + i >= first_block && get_inode_map(node_index)->pointers[i] != -1)
+            {
+                release_block(get_inode_map(node_index)->pointers[i]);
+                get_inode_map(node_index)->pointers[i] = -1;
+            }
+        }
+
+        // indirect inodes that start past the new end are released entirely
+        if (prev_index != -1 && base >= first_block)
+        {
+            if (get_inode_map(prev_index)->ind_pointer == node_index)
+                get_inode_map(prev_index)->ind_pointer = -1;
+            release_inode(node_index);
+        }
+        else
+            prev_index = node_index;
+
+        node_index = next_index;
+        base += NUM_POINTERS;
+    }
+}
+
+// moves the bytes of an inline file into a data block once it outgrows its inode.
+// only memory is updated, the caller flushes the bitmap and inode table
+int promote_inline(int inode_index)
+{
+    TRACE_SCOPE("promote_inline");
+    char block[BLOCK_SIZE];
+    inode_map_t *map = get_inode_map(inode_index);
+
+    if (!(inode_flags[inode_index] & INODE_INLINE))
+        return 0;
+
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, map->data, INLINE_MAX_SIZE);
+    for (int j = 0; j < NUM_POINTERS; j++)
+        map->pointers[j] = -1;
+    inode_flags[inode_index] &= ~INODE_INLINE;
+
+    if (inode_sizes[inode_index] > 0)
+    {
+        int block_index = map_block(inode_index, 0, 1, NULL);
+        if (block_index == -1)
+        {
+            printf("ERROR (promote_inline): could not find an empty block.\n");
+            memcpy(map->data, block, INLINE_MAX_SIZE);
+            inode_flags[inode_index] |= INODE_INLINE;
+            return -1;
+        }
+        disk_write(block_index, 1, block, file_write_kind(inode_index));
+    }
+    return 1;
+}
+
+// copies the last partial block of a packed file out of its tail block into a block
+// of its own, before the file is written. only memory is updated, the caller flushes
+int unpack_tail(int inode_index)
+{
+    TRACE_SCOPE("unpack_tail");
+    char block[BLOCK_SIZE];
+    inode_map_t *map = get_inode_map(inode_index);
+    int length = inode_sizes[inode_index] % BLOCK_SIZE;
+
+    if (!(inode_flags[inode_index] & INODE_TAIL))
+        return 0;
+
+    disk_read(map->tail_block, 1, block);
+    memmove(block, block + map->tail_offset, length);
+    memset(block + length, 0, BLOCK_SIZE - length);
+
+    int block_index = map_block(inode_index, inode_sizes[inode_index] / BLOCK_SIZE, 1, NULL);
+    if (block_index == -1)
+    {
+        printf("ERROR (unpack_tail): could not find an empty block.\n");
+        return -1;
+    }
+    disk_write(block_index, 1, block, WRITE_DATA);
+    release_block(map->tail_block);
+    inode_flags[inode_index] &= ~INODE_TAIL;
+    return 1;
+}
+
+// moves the last partial block of a file into the current tail block, next to the
+// tails of other files, and frees the block it was in. every packed tail is one owner
+// of its tail block. returns 1 if the tail was packed
+int pack_tail(int inode_index)
+{
+    TRACE_SCOPE("pack_tail");
+    char block[BLOCK_SIZE];
+    char tail[BLOCK_SIZE];
+    int size = inode_sizes[load_inode(inode_index)];
+    int length = size % BLOCK_SIZE;
+    int file_block = size / BLOCK_SIZE;
+
+    if (inode_flags[inode_index] & (INODE_DIR | INODE_HEAP | INODE_INLINE | INODE_TAIL | INODE_COMPRESSED))
+        return 0;
+    if (length == 0 || length > TAIL_MAX_SIZE)
+        return 0;
+
+    // a block shared with a clone or snapshot is left alone, packing it frees nothing
+    int block_index = map_block(inode_index, file_block, 0, NULL);
+    if (block_index == -1 || get_block_shares()[block_index] > 0)
+        return 0;
+
+    // the current tail block takes the fragment if it has room and can take an owner
+    if (tail_block != -1 && tail_used + length <= BLOCK_SIZE && get_block_shares()[tail_block] < MAX_BLOCK_SHARES)
+    {
+        disk_read(tail_block, 1, tail);
+        block_shares[tail_block]++;
+        block_shares_dirty = 1;
+    }
+    else
+    {
+        int new_block = get_unused_block();
+        if (new_block == -1)
+            return 0;
+        set_bit(free_bits(), new_block);
+        memset(tail, 0, BLOCK_SIZE);
+        tail_block = new_block;
+        tail_used = 0;
+    }
+
+    disk_read(block_index, 1, block);
+    memcpy(tail + tail_used, block, length);
+    disk_write(tail_block, 1, tail, WRITE_DATA);
+
+    get_inode_map(inode_index)->tail_block = tail_block;
+    get_inode_map(inode_index)->tail_offset = tail_used;
+    inode_flags[inode_index] |= INODE_TAIL;
+    tail_used += length;
+
+    get_inode_map(get_chain_inode(inode_index, file_block, 0))->pointers[file_block % NUM_POINTERS] = -1;
+    release_block(block_index);
+    write_free_bitmap();
+    write_inode_table();
+    return 1;
+}
+
+// reads the block of a file holding byte loc into buffer, a packed tail is copied out
+// of its tail block. returns the block read or -1 if loc is not mapped
+int read_file_block(int inode_index, int loc, char *buffer)
+{
+    inode_map_t *map = get_inode_map(inode_index);
+    int size = inode_sizes[load_inode(inode_index)];
+
+    if ((inode_flags[inode_index] & INODE_TAIL) && loc / BLOCK_SIZE == size / BLOCK_SIZE)
+    {
+        disk_read(map->tail_block, 1, buffer);
+        memmove(buffer, buffer + map->tail_offset, size % BLOCK_SIZE);
+        memset(buffer + size % BLOCK_SIZE, 0, BLOCK_SIZE - size % BLOCK_SIZE);
+        return map->tail_block;
+    }
+
+    int block_index = get_block(inode_index, loc);
+    if (block_index != -1)
+        disk_read(block_index, 1, buffer);
+    return block_index;
+}
+
+// transfers nblocks file blocks starting at first_block between the disk and buffer,
+// physically contiguous runs are coalesced into a single read_blocks/write_blocks call.
+// holes read as zeros and get a block when written, shared blocks are replaced first
+int transfer_file_blocks(int inode_index, int first_block, int nblocks, char *buffer, int write)
+{
+    int run_start = -1;
+    int run_length = 0;
+    int run_offset = 0;
+    int remapped = 0;
+    int tail = -1;
+
+    // a packed tail is not a block of its own, it is copied out after the runs
+    if (!write && (inode_flags[load_inode(inode_index)] & INODE_TAIL) && first_block + nblocks > inode_sizes[inode_index] / BLOCK_SIZE)
+    {
+        tail = inode_sizes[inode_index] / BLOCK_SIZE - first_block;
+        nblocks = tail;
+    }
+
+    for (int i = 0; i <= nblocks; i++)
+    {
+        int block_index = -1;
+        if (i < nblocks)
+        {
+            block_index = get_block(inode_index, (first_block + i) * BLOCK_SIZE);
+            if (block_index == -1 && write)
+            {
+                // a hole written through a mapping gets a block of its own
+                block_index = map_block(inode_index, first_block + i, 1, NULL);
+                remapped = 1;
+            }
+            else if (block_index != -1 && write && get_block_shares()[block_index] > 0)
+            {
+                block_index = unshare_block(inode_index, first_block + i, block_index);
+                remapped = 1;
+            }
+            if (block_index == -1 && write)
+            {
+                printf("ERROR (transfer_file_blocks): could not find an empty block.\n");
+                return -1;
+            }
+
+            // a hole breaks the run and reads as zeros
+            if (block_index == -1)
+                memset(buffer + i * BLOCK_SIZE, 0, BLOCK_SIZE);
+            else if (run_length > 0 && block_index == run_start + run_length)
+            {
+                run_length++;
+                continue;
+            }
+        }
+
+        // flush the current run
+        if (run_length > 0)
+        {
+            if (write)
+                disk_write(run_start, run_length, buffer + run_offset * BLOCK_SIZE, file_write_kind(inode_index));
+            else
+                disk_read(run_start, run_length, buffer + run_offset * BLOCK_SIZE);
+        }
+        run_start = block_index;
+        run_length = block_index == -1 ? 0 : 1;
+        run_offset = i;
+    }
+    if (tail >= 0)
+        read_file_block(inode_index, (first_block + tail) * BLOCK_SIZE, buffer + tail * BLOCK_SIZE);
+
+    if (remapped)
+    {
+        write_free_bitmap();
+        write_inode_table();
+    }
+    return 0;
+}
+
+// bytes of the file covered by cluster of a compressed file
+int cluster_length(int inode_index, int cluster)
+{
+    int length = inode_sizes[load_inode(inode_index)] - cluster * CLUSTER_SIZE;
+    if (length < 0)
+        return 0;
+    return length > CLUSTER_SIZE ? CLUSTER_SIZE : length;
+}
+
+// reads cluster of a compressed file into data, CLUSTER_SIZE bytes zeroed past the end
+// of the file. a cluster mapping fewer blocks than it covers is compressed and starts
+// with its compressed length, a fully mapped one is stored as is
+int load_cluster(int inode_index, int cluster, char *data)
+{
+    TRACE_SCOPE("load_cluster");
+    char stored[CLUSTER_SIZE];
+    int first_block = cluster * CLUSTER_BLOCKS;
+    int nblocks = (cluster_length(inode_index, cluster) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int mapped = 0;
+    int length;
+
+    memset(data, 0, CLUSTER_SIZE);
+    while (mapped < nblocks && get_block(inode_index, (first_block + mapped) * BLOCK_SIZE) != -1)
+        mapped++;
+    if (mapped == 0)
+        return 0;
+    if (mapped == nblocks)
+        return transfer_file_blocks(inode_index, first_block, nblocks, data, 0);
+
+    if (transfer_file_blocks(inode_index, first_block, mapped, stored, 0) < 0)
+        return -1;
+    memcpy(&length, stored, sizeof(int));
+    if (length < 0 || length > mapped * BLOCK_SIZE - (int)sizeof(int) || lz_decompress(stored + sizeof(int), length, data, CLUSTER_SIZE) < 0)
+    {
+        printf("ERROR (load_cluster): cluster %i of inode %i is corrupt.\n", cluster, inode_index);
+        return -1;
+    }
+    return 0;
+}
+
+// writes length bytes of data as cluster of a compressed file, compressed when that
+// saves a block. the old blocks are released once the new ones are written.
+// only memory is updated, the caller flushes
+int store_cluster(int inode_index, int cluster, char *data, int length)
+{
+    TRACE_SCOPE("store_cluster");
+    char stored[CLUSTER_SIZE];
+    int old_blocks[CLUSTER_BLOCKS];
+    int first_block = cluster * CLUSTER_BLOCKS;
+    int nblocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int stored_blocks = nblocks;
+    int compressed = -1;
+
+    if (nblocks > 1)
+        compressed = lz_compress(data, length, stored + sizeof(int), (nblocks - 1) * BLOCK_SIZE - sizeof(int));
+    if (compressed >= 0)
+    {
+        memcpy(stored, &compressed, sizeof(int));
+        stored_blocks = (sizeof(int) + compressed + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        memset(stored + sizeof(int) + compressed, 0, stored_blocks * BLOCK_SIZE - sizeof(int) - compressed);
+    }
+    else
+    {
+        memcpy(stored, data, length);
+        memset(stored + length, 0, nblocks * BLOCK_SIZE - length);
+    }
+
+    // unhook the old blocks, they stay allocated so the new ones land elsewhere
+    for (int i = 0; i < CLUSTER_BLOCKS; i++)
+    {
+        int node_index = get_chain_inode(inode_index, first_block + i, 0);
+        old_blocks[i] = -1;
+        if (node_index < 0)
+            continue;
+        old_blocks[i] = get_inode_map(node_index)->pointers[(first_block + i) % NUM_POINTERS];
+        get_inode_map(node_index)->pointers[(first_block + i) % NUM_POINTERS] = -1;
+    }
+
+    for (int i = 0; i < stored_blocks; i++)
+    {
+        if (map_block(inode_index, first_block + i, 1, NULL) != -1)
+            continue;
+
+        // put the old cluster back
+        printf("ERROR (store_cluster): could not find an empty block.\n");
+        for (int j = 0; j < CLUSTER_BLOCKS; j++)
+        {
+            int node_index = get_chain_inode(inode_index, first_block + j, 0);
+            if (node_index < 0)
+                continue;
+            int *pointer = &get_inode_map(node_index)->pointers[(first_block + j) % NUM_POINTERS];
+            if (*pointer != -1)
+                release_block(*pointer);
+            *pointer = old_blocks[j];
+        }
+        return -1;
+    }
+    if (transfer_file_blocks(inode_index, first_block, stored_blocks, stored, 1) < 0)
+        return -1;
+
+    for (int i = 0; i < CLUSTER_BLOCKS; i++)
+        if (old_blocks[i] != -1)
+            release_block(old_blocks[i]);
+    return 0;
+}
+
+// reads up to length bytes at offset of a compressed file, a cluster at a time.
+// returns the number of bytes read, which stops at the end of the file, or -1
+int read_compressed(int inode_index, int offset, char *buf, int length)
+{
+    char data[CLUSTER_SIZE];
+    int size = inode_sizes[load_inode(inode_index)];
+    int read_amount = 0;
+
+    if (offset >= size)
+        return 0;
+    if (length > size - offset)
+        length = size - offset;
+
+    while (read_amount < length)
+    {
+        int cluster = (offset + read_amount) / CLUSTER_SIZE;
+        int location = (offset + read_amount) % CLUSTER_SIZE;
+        int copy_amount = CLUSTER_SIZE - location;
+        if (copy_amount > length - read_amount)
+            copy_amount = length - read_amount;
+
+        if (load_cluster(inode_index, cluster, data) < 0)
+            return -1;
+        memcpy(buf + read_amount, data + location, copy_amount);
+        read_amount += copy_amount;
+    }
+    return read_amount;
+}
+
+// writes length bytes at the write pointer of a compressed file. every cluster
+// touched is decompressed, patched and stored again. returns length or -1
+int write_compressed(int fileID, char *buf, int length)
+{
+    char data[CLUSTER_SIZE];
+    int inode_index = file_descriptors[fileID].inode;
+    int written = 0;
+
+    while (written < length)
+    {
+        int write_pointer = file_descriptors[fileID].write_pointer;
+        int cluster = write_pointer / CLUSTER_SIZE;
+        int location = write_pointer % CLUSTER_SIZE;
+        int cluster_end = cluster_length(inode_index, cluster);
+        int copy_amount = CLUSTER_SIZE - location;
+        if (copy_amount > length - written)
+            copy_amount = length - written;
+
+        if (load_cluster(inode_index, cluster, data) < 0)
+            break;
+        memcpy(data + location, buf + written, copy_amount);
+        if (location + copy_amount > cluster_end)
+            cluster_end = location + copy_amount;
+        if (store_cluster(inode_index, cluster, data, cluster_end) < 0)
+            break;
+
+        // the size only moves once the cluster is stored, loads go by it
+        written += copy_amount;
+        file_descriptors[fileID].write_pointer += copy_amount;
+        if (file_descriptors[fileID].write_pointer > inode_sizes[inode_index])
+            inode_sizes[inode_index] = file_descriptors[fileID].write_pointer;
+    }
+
+    write_free_bitmap();
+    write_inode_table();
+    if (written < length)
+        return -1;
+    return length;
+}
+
+// extends a file to size bytes without writing the range past its old end, which is
+// left as a hole reading as zeros. bytes that could show through are cleared first:
+// the rest of the old last block and blocks preallocated past the end. a packed tail
+// goes back to a block and a compressed file stores the cluster holding the old end
+// again at its new length. the caller flushes the bitmap and inode table
+int grow_file(int inode_index, int size)
+{
+    TRACE_SCOPE("grow_file");
+    char block[BLOCK_SIZE];
+    int old_size = inode_sizes[load_inode(inode_index)];
+
+    if (size <= old_size)
+        return 0;
+
+    // the inode bytes past the end of an inline file are kept zeroed
+    if (inode_flags[inode_index] & INODE_INLINE)
+    {
+        if (size <= INLINE_MAX_SIZE)
+        {
+            inode_sizes[inode_index] = size;
+            return 0;
+        }
+        if (promote_inline(inode_index) < 0)
+            return -1;
+    }
+
+    // a cluster's length decides how it is read back, so it is stored again at the new one
+    if (inode_flags[inode_index] & INODE_COMPRESSED)
+    {
+        if (old_size % CLUSTER_SIZE != 0)
+        {
+            char data[CLUSTER_SIZE];
+            int cluster = old_size / CLUSTER_SIZE;
+            int length = size - cluster * CLUSTER_SIZE;
+            if (length > CLUSTER_SIZE)
+                length = CLUSTER_SIZE;
+            if (load_cluster(inode_index, cluster, data) < 0 || store_cluster(inode_index, cluster, data, length) < 0)
+                return -1;
+        }
+        inode_sizes[inode_index] = size;
+        return 0;
+    }
+
+    if (unpack_tail(inode_index) < 0)
+        return -1;
+
+    // a file cut by ftruncate keeps its old bytes past the end of its last block
+    int block_index = old_size % BLOCK_SIZE != 0 ? map_block(inode_index, old_size / BLOCK_SIZE, 0, NULL) : -1;
+    if (block_index != -1)
+    {
+        disk_read(block_index, 1, block);
+        memset(block + old_size % BLOCK_SIZE, 0, BLOCK_SIZE - old_size % BLOCK_SIZE);
+        if (write_file_block(inode_index, old_size / BLOCK_SIZE, block) < 0)
+            return -1;
+    }
+
+    // blocks from ssfs_fallocate hold whatever was on the disk before
+    memset(block, 0, BLOCK_SIZE);
+    for (int fb = (old_size + BLOCK_SIZE - 1) / BLOCK_SIZE; fb < (size + BLOCK_SIZE - 1) / BLOCK_SIZE; fb++)
+    {
+        int node_index = get_chain_inode(inode_index, fb, 0);
+        if (node_index < 0)
+            break;
+        if (get_inode_map(node_index)->pointers[fb % NUM_POINTERS] != -1 && write_file_block(inode_index, fb, block) < 0)
+            return -1;
+    }
+
+    inode_sizes[inode_index] = size;
+    return 0;
+}
+
+// writes back the dirty blocks of fileID's mapping and releases it
+int release_mapping(int fileID, int write_back)
+{
+    file_descriptor_t *fd = &file_descriptors[fileID];
+    int ret = 0;
+
+    if (fd->map == NULL)
+        return 0;
+
+    if (write_back && (fd->map_flags & SSFS_MAP_WRITE))
+    {
+        for (int i = 0; i < fd->map_blocks; i++)
+        {
+            if (!test_bit(fd->map_dirty, i))
+                continue;
+
+            // extend to the whole run of dirty blocks
+            int j = i;
+            while (j + 1 < fd->map_blocks && test_bit(fd->map_dirty, j + 1))
+                j++;
+            if (transfer_file_blocks(fd->inode, i, j - i + 1, fd->map + i * BLOCK_SIZE, 1) < 0)
+                ret = -1;
+            i = j;
+        }
+    }
+
+    free(fd->map);
+    free(fd->map_dirty);
+    fd->map = NULL;
+    fd->map_dirty = NULL;
+    fd->map_flags = 0;
+    fd->map_blocks = 0;
+    return ret;
+}
+
+// hashes a name of len bytes
+uint32_t hash_name(char *name, int len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// loads name heap block b into heap_cache
+char *load_heap_block(int b)
+{
+    if (heap_cache_block != b)
+    {
+        int block_index = map_block(super_block.name_heap, b, 0, NULL);
+        if (block_index == -1)
+        {
+            printf("ERROR (load_heap_block): name heap block %i is not mapped.\n", b);
+            return NULL;
+        }
+        disk_read(block_index, 1, heap_cache);
+        heap_cache_block = b;
+    }
+    return heap_cache;
+}
+
+// writes name heap block b from heap_cache along with its header
+void store_heap_block(int b)
+{
+    int header[2] = {heap_tail[b], heap_live[b]};
+
+    memcpy(heap_cache, header, NAME_HEAP_HEADER);
+    write_file_block(super_block.name_heap, b, heap_cache);
+}
+
+// reads the header of every name heap block, done on the first name allocated or freed
+int load_name_heap()
+{
+    int header[2];
+
+    free(heap_tail);
+    free(heap_live);
+    name_heap_loaded = 1;
+    heap_blocks = inode_sizes[load_inode(super_block.name_heap)] / BLOCK_SIZE;
+    heap_tail = malloc((heap_blocks + 1) * sizeof(int));
+    heap_live = malloc((heap_blocks + 1) * sizeof(int));
+    heap_cache_block = -1;
+    if (heap_tail == NULL || heap_live == NULL)
+    {
+        printf("ERROR (load_name_heap): could not allocate memory for heap summary.\n");
+        return -1;
+    }
+
+    for (int b = 0; b < heap_blocks; b++)
+    {
+        if (load_heap_block(b) == NULL)
+            return -1;
+        memcpy(header, heap_cache, NAME_HEAP_HEADER);
+        heap_tail[b] = header[0];
+        heap_live[b] = header[1];
+    }
+    return 0;
+}
+
+// stores len bytes of name in the name heap and returns their offset, a name
+// never crosses a block so it is read back with a single block read
+int heap_alloc(char *name, int len)
+{
+    int b;
+
+    if (!name_heap_loaded && load_name_heap() < 0)
+        return -1;
+
+    for (b = 0; b < heap_blocks; b++)
+        if (BLOCK_SIZE - heap_tail[b] >= len)
+            break;
+
+    // add a block to the heap
+    if (b == heap_blocks)
+    {
+        int *tail = realloc(heap_tail, (heap_blocks + 1) * sizeof(int));
+        int *live = tail == NULL ? NULL : realloc(heap_live, (heap_blocks + 1) * sizeof(int));
+        if (tail != NULL)
+            heap_tail = tail;
+        if (live != NULL)
+            heap_live = live;
+        if (tail == NULL || live == NULL || map_block(super_block.name_heap, b, 1, NULL) == -1)
+        {
+            printf("ERROR (heap_alloc): could not grow the name heap.\n");
+            return -1;
+        }
+        heap_blocks++;
+        heap_tail[b] = NAME_HEAP_HEADER;
+        heap_live[b] = 0;
+        inode_sizes[load_inode(super_block.name_heap)] = heap_blocks * BLOCK_SIZE;
+        memset(heap_cache, 0, BLOCK_SIZE);
+        heap_cache_block = b;
+        write_free_bitmap();
+        write_inode_table();
+    }
+    else if (load_heap_block(b) == NULL)
+        return -1;
+
+    memcpy(heap_cache + heap_tail[b], name, len);
+    int offset = b * BLOCK_SIZE + heap_tail[b];
+    heap_tail[b] += len;
+    heap_live[b] += len;
+    store_heap_block(b);
+    return offset;
+}
+
+// releases a name, a heap block is reused from the start once none of its names are live
+void heap_free(int offset, int len)
+{
+    int b = offset / BLOCK_SIZE;
+
+    if (!name_heap_loaded && load_name_heap() < 0)
+        return;
+
+    heap_live[b] -= len;
+    if (heap_live[b] <= 0)
+    {
+        heap_live[b] = 0;
+        heap_tail[b] = NAME_HEAP_HEADER;
+    }
+    if (load_heap_block(b) != NULL)
+        store_heap_block(b);
+}
+
+// copies the name of a directory entry into name, NUL terminated
+int read_name(dirent_t *entry, char *name)
+{
+    if (load_heap_block(entry->name_offset / BLOCK_SIZE) == NULL)
+        return -1;
+    memcpy(name, heap_cache + entry->name_offset % BLOCK_SIZE, entry->name_len);
+    name[entry->name_len] = '\0';
+    return 0;
+}
+
+// checks whether a directory entry holds name, hash and length are compared
+// before any name byte is read
+int dirent_matches(dirent_t *entry, char *name, int len, uint32_t hash)
+{
+    if (entry->inode < 0 || entry->hash != hash || entry->name_len != len)
+        return 0;
+    if (load_heap_block(entry->name_offset / BLOCK_SIZE) == NULL)
+        return 0;
+    return memcmp(heap_cache + entry->name_offset % BLOCK_SIZE, name, len) == 0;
+}
+
+// gets the number of dirent blocks of directory dir
+int dir_num_blocks(int dir)
+{
+    if (dir == ROOT_DIR)
+        return ROOT_DIR_BLOCKS;
+    return inode_sizes[load_inode(dir)] / BLOCK_SIZE;
+}
+
+// reads dirent block b of directory dir
+int read_dir_block(int dir, int b, dirent_t *entries)
+{
+    if (dir == ROOT_DIR)
+    {
+        load_root_block(b);
+        memcpy(entries, &root_dir[b * DIRENTS_PER_BLOCK], BLOCK_SIZE);
+        return 0;
+    }
+
+    int block_index = map_block(dir, b, 0, NULL);
+    if (block_index == -1)
+    {
+        printf("ERROR (read_dir_block): directory block %i is not mapped.\n", b);
+        return -1;
+    }
+    disk_read(block_index, 1, entries);
+    return 0;
+}
+
+// writes dirent block b of directory dir, the only write an entry update needs
+int write_dir_block(int dir, int b, dirent_t *entries)
+{
+    if (dir == ROOT_DIR)
+    {
+        if (entries != &root_dir[b * DIRENTS_PER_BLOCK])
+            memcpy(&root_dir[b * DIRENTS_PER_BLOCK], entries, BLOCK_SIZE);
+        set_bit(root_blocks_loaded, b);
+        disk_write(super_block.root_start + b, 1, &root_dir[b * DIRENTS_PER_BLOCK], WRITE_METADATA);
+        return 0;
+    }
+
+    if (write_file_block(dir, b, entries) < 0)
+    {
+        printf("ERROR (write_dir_block): directory block %i is not mapped.\n", b);
+        return -1;
+    }
+    return 0;
+}
+
+// looks up name in directory dir and returns its inode, -1 if it does not exist.
+// directories are hashed: an entry lives in block hash % nblocks or, when
+// that one was full, in one of the following blocks. the probe ends at the
+// first block that still has an empty slot
+int dir_find(int dir, char *name, int *found_block, int *found_slot)
+{
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    int len = strlen(name);
+    uint32_t hash = hash_name(name, len);
+    int nblocks = dir_num_blocks(dir);
+    int b = hash % nblocks;
+
+    for (int probe = 0; probe < nblocks; probe++, b = (b + 1) % nblocks)
+    {
+        int has_empty = 0;
+
+        if (read_dir_block(dir, b, entries) < 0)
+            return -1;
+        for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            if (entries[i].inode == DIRENT_EMPTY)
+                has_empty = 1;
+            else if (dirent_matches(&entries[i], name, len, hash))
+            {
+                if (found_block != NULL)
+                    *found_block = b;
+                if (found_slot != NULL)
+                    *found_slot = i;
+                return entries[i].inode;
+            }
+        }
+        if (has_empty)
+            break;
+    }
+
+    return -1;
+}
+
+// places an entry in the first block of its probe sequence with a free slot
+int dir_place(dirent_t *blocks, int nblocks, dirent_t *entry, int probe_limit)
+{
+    int b = entry->hash % nblocks;
+
+    for (int probe = 0; probe < probe_limit && probe < nblocks; probe++, b = (b + 1) % nblocks)
+    {
+        for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            dirent_t *slot = &blocks[b * DIRENTS_PER_BLOCK + i];
+            if (slot->inode == DIRENT_EMPTY || slot->inode == DIRENT_DELETED)
+            {
+                *slot = *entry;
+                return b;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// doubles the dirent blocks of directory dir and rehashes its entries. every
+// entry can change slot, which invalidates the ssfs_readdir cookies of dir
+int grow_dir(int dir)
+{
+    int nblocks = dir_num_blocks(dir);
+    dirent_t *old_blocks = malloc(nblocks * BLOCK_SIZE);
+    dirent_t *new_blocks = malloc(2 * nblocks * BLOCK_SIZE);
+    int ret = 0;
+
+    if (old_blocks == NULL || new_blocks == NULL)
+    {
+        printf("ERROR (grow_dir): could not allocate memory for directory blocks.\n");
+        free(old_blocks);
+        free(new_blocks);
+        return -1;
+    }
+
+    for (int b = 0; b < nblocks; b++)
+        if (read_dir_block(dir, b, old_blocks + b * DIRENTS_PER_BLOCK) < 0)
+            ret = -1;
+
+    // map the new blocks, the old ones are kept in place
+    for (int b = nblocks; b < 2 * nblocks && ret == 0; b++)
+    {
+        if (map_block(dir, b, 1, NULL) == -1)
+        {
+            printf("ERROR (grow_dir): could not find an empty block.\n");
+            free_file_blocks(dir, nblocks);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0)
+    {
+        for (int i = 0; i < 2 * nblocks * DIRENTS_PER_BLOCK; i++)
+        {
+            memset(&new_blocks[i], 0, sizeof(dirent_t));
+            new_blocks[i].inode = DIRENT_EMPTY;
+        }
+        for (int i = 0; i < nblocks * DIRENTS_PER_BLOCK; i++)
+            if (old_blocks[i].inode >= 0)
+                dir_place(new_blocks, 2 * nblocks, &old_blocks[i], 2 * nblocks);
+
+        inode_sizes[load_inode(dir)] = 2 * nblocks * BLOCK_SIZE;
+        for (int b = 0; b < 2 * nblocks; b++)
+            write_dir_block(dir, b, new_blocks + b * DIRENTS_PER_BLOCK);
+    }
+
+    write_free_bitmap();
+    write_inode_table();
+    free(old_blocks);
+    free(new_blocks);
+    return ret;
+}
+
+// adds name -> inode_index to directory dir, the name goes to the name heap and
+// only the dirent block taking the entry is written
+int dir_insert(int dir, char *name, int inode_index)
+{
+    dirent_t entry;
+    dirent_t entries[DIRENTS_PER_BLOCK];
+
+    entry.name_len = strlen(name);
+    entry.hash = hash_name(name, entry.name_len);
+    entry.inode = inode_index;
+    entry.name_offset = heap_alloc(name, entry.name_len);
+    if (entry.name_offset < 0)
+        return -1;
+
+    while (1)
+    {
+        int nblocks = dir_num_blocks(dir);
+        int b = entry.hash % nblocks;
+
+        // the root region cannot grow, so every one of its blocks is probed
+        int probe_limit = dir == ROOT_DIR ? nblocks : DIR_PROBE_LIMIT;
+        for (int probe = 0; probe < probe_limit && probe < nblocks; probe++, b = (b + 1) % nblocks)
+        {
+            if (read_dir_block(dir, b, entries) < 0)
+                break;
+            if (dir_place(entries, 1, &entry, 1) == 0)
+                return write_dir_block(dir, b, entries);
+        }
+
+        if (dir == ROOT_DIR)
+            printf("ERROR (dir_insert): root directory is full.\n");
+        if (dir == ROOT_DIR || grow_dir(dir) < 0)
+        {
+            heap_free(entry.name_offset, entry.name_len);
+            return -1;
+        }
+    }
+}
+
+// clears a slot of a dirent block and releases its name. probes already stop at
+// a block with an empty slot, so a tombstone is only needed when the block has none
+void clear_dirent(dirent_t *entries, int slot)
+{
+    int has_empty = 0;
+
+    for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        if (entries[i].inode == DIRENT_EMPTY)
+            has_empty = 1;
+
+    heap_free(entries[slot].name_offset, entries[slot].name_len);
+    memset(&entries[slot], 0, sizeof(dirent_t));
+    entries[slot].inode = has_empty ? DIRENT_EMPTY : DIRENT_DELETED;
+}
+
+// removes name from directory dir, only the block holding the entry is written
+int dir_remove(int dir, char *name)
+{
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    int b = -1;
+    int slot = -1;
+
+    if (dir_find(dir, name, &b, &slot) < 0)
+        return -1;
+    if (read_dir_block(dir, b, entries) < 0)
+        return -1;
+    clear_dirent(entries, slot);
+    return write_dir_block(dir, b, entries);
+}
+
+// splits path into the directory holding its last component and that
+// component, every intermediate component has to be a directory
+int resolve_path(char *path, int *dir, char *leaf)
+{
+    char component[MAX_NAME_LEN + 1];
+    int current = ROOT_DIR;
+    char *p = path;
+
+    p += strspn(p, "/");
+    if (*p == '\0')
+    {
+        printf("ERROR (resolve_path): empty path.\n");
+        return -1;
+    }
+
+    while (1)
+    {
+        char *end = strchr(p, '/');
+        int len = end == NULL ? strlen(p) : end - p;
+        if (len > MAX_NAME_LEN)
+        {
+            printf("ERROR (resolve_path): name longer than %i bytes.\n", MAX_NAME_LEN);
+            return -1;
+        }
+        memcpy(component, p, len);
+        component[len] = '\0';
+
+        // the last component, trailing slashes are ignored
+        if (end == NULL || end[strspn(end, "/")] == '\0')
+        {
+            memcpy(leaf, component, len + 1);
+            *dir = current;
+            return 0;
+        }
+
+        int next = dir_find(current, component, NULL, NULL);
+        if (next < 0 || !(inode_flags[load_inode(next)] & INODE_DIR))
+        {
+            printf("ERROR (resolve_path): %s is not a directory.\n", component);
+            return -1;
+        }
+        current = next;
+        p = end + strspn(end, "/");
+    }
+}
+
+// refuses a call that would change the volume while a snapshot is mounted
+int check_writable(char *func)
+{
+    if (read_only)
+    {
+        printf("ERROR (%s): volume is mounted read-only.\n", func);
+        return -1;
+    }
+    return 0;
+}
+
+// sets up the in memory state for the volume described by super_block, forgetting
+// whatever a previous mount left. when lazy metadata is only read on first use
+void load_volume(int lazy)
+{
+    TRACE_SCOPE("load_volume");
+    memset(inode_blocks_loaded, 0, sizeof(inode_blocks_loaded));
+    memset(inode_images_valid, 0, sizeof(inode_images_valid));
+    memset(root_blocks_loaded, 0, sizeof(root_blocks_loaded));
+    free_bitmap_loaded = 0;
+    block_shares_loaded = 0;
+    block_shares_dirty = 0;
+    block_hashes_loaded = 0;
+    block_hashes_dirty = 0;
+    name_heap_loaded = 0;
+    heap_cache_block = -1;
+    tail_block = -1;
+    defrag_cursor = 0;
+
+    // read the root directory, inode table, free bitmap and name heap from the disk
+    if (!lazy)
+    {
+        load_root_dir();
+        read_inode_table();
+        free_bits();
+        get_block_shares();
+        get_block_hashes();
+        load_name_heap();
+    }
+    rebuild_inode_bitmap();
+    // initialize the file descriptor table
+    initialize_fd_table();
+}
+
+// either initializes a new disk or loads an existing one depending on fresh.
+// with SSFS_MOUNT_LAZY only the super block is read, the inode table, free bitmap,
+// root directory and name heap are read a block at a time when first needed
+void mkssfs(int fresh)
+{
+    FS_LOCKED();
+    // SSFS_TRACE=path traces the whole run and dumps it to path at exit
+    if (trace_exit_path == NULL && getenv("SSFS_TRACE") != NULL)
+    {
+        trace_exit_path = getenv("SSFS_TRACE");
+        trace_enabled = 1;
+        atexit(dump_trace_at_exit);
+    }
+    TRACE_SCOPE("mkssfs");
+
+    // initialize the disk
+    if (fresh == 1)
+    {
+
+        if (init_fresh_disk(NAME, BLOCK_SIZE, NUM_BLOCKS) != 0)
+        {
+            printf("Error (mkssfs): could not create disk.\n");
+            exit(-1);
+        }
+
+        // initialzie the inode table and reserve the name heap inode
+        read_only = 0;
+        tail_block = -1;
+        initialize_inode_table();
+        rebuild_inode_bitmap();
+        initialize_super_block();
+        super_block.name_heap = get_unused_inode();
+        inode_sizes[load_inode(super_block.name_heap)] = 0;
+        inode_flags[load_inode(super_block.name_heap)] = INODE_HEAP;
+        load_name_heap();
+        // write the super block, root directory and inode table
+        write_super_block();
+        initialize_root_dir();
+        disk_write(ROOT_DIR_START, ROOT_DIR_BLOCKS, root_dir, WRITE_METADATA);
+        write_inode_table();
+        // initialize and write the free bitmap
+        initialize_free_bitmap();
+        write_free_bitmap();
+        // initialize the file descriptor table
+        initialize_fd_table();
+    }
+    // get existing disk
+    else
+    {
+        if (init_disk(NAME, BLOCK_SIZE, NUM_BLOCKS) != 0)
+        {
+            printf("Error (mkssfs): could not create disk.\n");
+            exit(-1);
+        }
+
+        // read and check the super block
+        read_super_block();
+        if (super_block.id != MAGIC_NUM || super_block.block_size != BLOCK_SIZE || super_block.num_blocks != NUM_BLOCKS)
+        {
+            printf("Error (mkssfs): disk is not a ssfs volume of this version.\n");
+            exit(-1);
+        }
+        read_only = 0;
+        load_volume(fresh == SSFS_MOUNT_LAZY);
+    }
+}
+
+// mounts snapshot read-only, the live volume is left as it is on the disk
+int mkssfs_snapshot(int snapshot)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("mkssfs_snapshot");
+    char block[BLOCK_SIZE];
+
+    if (init_disk(NAME, BLOCK_SIZE, NUM_BLOCKS) != 0)
+    {
+        printf("Error (mkssfs_snapshot): could not open disk.\n");
+        return -1;
+    }
+    // both super blocks are checked in locals so a refused mount leaves the current one alone
+    super_block_t live, frozen;
+    disk_read(0, 1, block);
+    memcpy(&live, block, sizeof(live));
+    if (live.id != MAGIC_NUM || snapshot < 0 || snapshot >= MAX_SNAPSHOTS || live.snapshots[snapshot] < FIRST_DATA_BLOCK || live.snapshots[snapshot] + SNAPSHOT_BLOCKS > NUM_DATA_BLOCKS)
+    {
+        printf("ERROR (mkssfs_snapshot): no snapshot %i.\n", snapshot);
+        return -1;
+    }
+
+    // the snapshot starts with its own copy of the super block
+    disk_read(live.snapshots[snapshot], 1, block);
+    memcpy(&frozen, block, sizeof(frozen));
+    if (frozen.id != MAGIC_NUM || frozen.block_size != BLOCK_SIZE || frozen.num_blocks != NUM_BLOCKS)
+    {
+        printf("ERROR (mkssfs_snapshot): snapshot %i has a damaged super block.\n", snapshot);
+        return -1;
+    }
+    super_block = frozen;
+    read_only = 1;
+    load_volume(1);
+    return 0;
+}
+
+int open_file(char *name)
+{
+    char leaf[MAX_NAME_LEN + 1];
+    int dir;
+    int fd_index;
+    int inode_index;
+
+    // get an unsused file descriptor slot
+    fd_index = get_unused_fd();
+    if (fd_index == -1)
+    {
+        printf("ERROR (ssfs_open): already at maximum amount of file descriptors.\n");
+        return -1;
+    }
+
+    // get the inode of the file if it already exists
+    if (resolve_path(name, &dir, leaf) < 0)
+    {
+        release_fd(fd_index);
+        return -1;
+    }
+    inode_index = dir_find(dir, leaf, NULL, NULL);
+
+    // check to see if the file already exits in the directory
+    if (inode_index < 0)
     {
-        // printf("file with name '%s' does not exist, creating new file...\n", name);
-        // printf("going to create a file with directory index = %i\n", directory_index);
 
         // get the index of an unused inode
+        if (check_writable("ssfs_open") < 0)
+        {
+            release_fd(fd_index);
+            return -1;
+        }
         inode_index = get_unused_inode();
         if (inode_index < 0)
         {
-            printf("ERROR (ssfs_open): could not find an empty inode.\n");
+            printf("ERROR (ssfs_open): could not find an empty inode.\n");
+            release_fd(fd_index);
+            return -1;
+        }
+
+        // add the directory entry
+        if (dir_insert(dir, leaf, inode_index) < 0)
+        {
+            printf("ERROR (ssfs_open): could not find an empty directory slot.\n");
+            release_inode(inode_index);
+            release_fd(fd_index);
+            return -1;
+        }
+
+        // update inode table, file descriptor table. new files start out inline
+        inode_sizes[load_inode(inode_index)] = 0;
+        inode_flags[load_inode(inode_index)] = INODE_INLINE;
+        memset(get_inode_map(inode_index)->data, 0, INLINE_MAX_SIZE);
+        file_descriptors[fd_index].inode = inode_index;
+        inode_opens[inode_index]++;
+        write_inode(inode_index);
+    }
+    // directories are only reachable through the directory calls
+    else if (inode_flags[load_inode(inode_index)] & INODE_DIR)
+    {
+        printf("ERROR (ssfs_open): %s is a directory.\n", name);
+        release_fd(fd_index);
+        return -1;
+    }
+    // if the file was already exists on the disk
+    else
+    {
+        // get inode from directory entry and initialize file descriptor
+        file_descriptors[fd_index].inode = inode_index;
+        file_descriptors[fd_index].write_pointer = inode_sizes[load_inode(inode_index)];
+        inode_opens[inode_index]++;
+    }
+
+    return fd_index;
+}
+
+int ssfs_fclose(int fileID)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fclose");
+    // check for invalid fileID
+    if (fileID >= fd_capacity)
+    {
+        printf("fclose(): fileID >= fd_capacity\n");
+        return -1;
+    }
+    else if (fileID < 0)
+    {
+        printf("fclose(): fileID < 0\n");
+        return -1;
+    }
+    else if (file_descriptors[fileID].inode == -1)
+    {
+        printf("fclose(): file_descriptors[fileID].inode == -1\n");
+        return -1;
+    }
+    else if (read_only)
+    {
+        // nothing on a mounted snapshot may be written, not even the metadata
+        release_mapping(fileID, 0);
+        release_fd(fileID);
+        return 0;
+    }
+    else
+    {
+        // check for empty file...
+        if (inode_sizes[load_inode(file_descriptors[fileID].inode)] == 0)
+        {
+            inode_sizes[load_inode(file_descriptors[fileID].inode)] = 0;
+            write_inode_table();
+        }
+
+        release_mapping(fileID, 1);
+
+        // the last descriptor of a file packs its partial last block
+        int inode_index = file_descriptors[fileID].inode;
+        release_fd(fileID);
+        if (inode_opens[inode_index] == 0)
+            pack_tail(inode_index);
+        return 0;
+    }
+}
+
+// drops a file's inodes, blocks and every descriptor open on it, the directory
+// entry is left to the caller. only the in memory structures are updated
+void release_file(int inode_index)
+{
+    // release the blocks and indirect inodes, then the direct inode itself
+    free_file_blocks(inode_index, 0);
+    release_inode(inode_index);
+
+    // reset the file descriptors
+    for (int j = 0; j < fd_capacity; j++)
+    {
+        if (file_descriptors[j].inode == inode_index)
+        {
+            release_mapping(j, 0);
+            release_fd(j);
+        }
+    }
+}
+
+// moves the read pointer, past the end of the file reads return nothing
+int seek_read(int fileID, int loc)
+{
+
+    // check for invalid value
+    if (loc < 0)
+    {
+        printf("ERROR (frseek): loc < 0\n");
+        return -1;
+    }
+
+    // get the inode index
+    int index = get_fd_inode(fileID);
+    if (index == -1)
+    {
+        printf("ERROR (frseek): invalid fileID\n");
+        return -1;
+    }
+
+    file_descriptors[fileID].read_pointer = loc;
+    return 0;
+}
+
+// moves the write pointer, a write past the end of the file leaves a hole before it
+int seek_write(int fileID, int loc)
+{
+    // check for invalid value
+    if (loc < 0)
+    {
+        printf("ERROR (fwseek): loc < 0\n");
+        return -1;
+    }
+
+    // get the inode index
+    int index = get_fd_inode(fileID);
+    if (index == -1)
+    {
+        printf("ERROR (fwseek): invalid fileID\n");
+        return -1;
+    }
+
+    file_descriptors[fileID].write_pointer = loc;
+    return 0;
+}
+
+// checks whether file block fb is a hole. a compressed file has holes a whole cluster
+// at a time, a stored cluster always maps its first block
+int is_hole(int inode_index, int fb)
+{
+    int flags = inode_flags[load_inode(inode_index)];
+
+    if (flags & INODE_INLINE)
+        return 0;
+    if (flags & INODE_COMPRESSED)
+        fb -= fb % CLUSTER_BLOCKS;
+    else if ((flags & INODE_TAIL) && fb == inode_sizes[inode_index] / BLOCK_SIZE)
+        return 0;
+    return map_block(inode_index, fb, 0, NULL) == -1;
+}
+
+// finds the first data (SSFS_SEEK_DATA) or hole (SSFS_SEEK_HOLE) at or after loc, a block
+// at a time. the end of the file counts as a hole. returns the offset, or -1 when loc is
+// past the end or no data follows it. neither pointer is moved
+int ssfs_flseek(int fileID, int loc, int whence)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_flseek");
+    int index = get_fd_inode(fileID);
+    if (index == -1)
+    {
+        printf("ERROR (flseek): invalid fileID\n");
+        return -1;
+    }
+    if (whence != SSFS_SEEK_DATA && whence != SSFS_SEEK_HOLE)
+    {
+        printf("ERROR (flseek): invalid whence\n");
+        return -1;
+    }
+    if (loc < 0)
+    {
+        printf("ERROR (flseek): loc < 0\n");
+        return -1;
+    }
+
+    int size = inode_sizes[load_inode(index)];
+    if (loc >= size)
+        return -1;
+
+    for (int fb = loc / BLOCK_SIZE; fb * BLOCK_SIZE < size; fb++)
+    {
+        if (is_hole(index, fb) == (whence == SSFS_SEEK_HOLE))
+            return fb * BLOCK_SIZE > loc ? fb * BLOCK_SIZE : loc;
+    }
+    return whence == SSFS_SEEK_HOLE ? size : -1;
+}
+
+// reads length bytes from fileID into buf
+// returns number of bytes read
+int read_file(int fileID, char *buf, int length)
+{
+    int read_amount = 0;
+    int copy_amount;
+    void *buffer = malloc(BLOCK_SIZE);
+    int inode_index = get_fd_inode(fileID);
+    int location;
+    int block_index;
+    int read_pointer;
+    int size;
+
+    // check for invalid length or fileID
+    if (length < 0 || fileID < 0 || fileID >= fd_capacity)
+    {
+        free(buffer);
+        return -1;
+    }
+    else if (length == 0)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    // check for a closed file
+    if (inode_index == -1)
+    {
+        printf("ERROR: (ssfs_read): fd entry was unitialized.\n");
+        free(buffer);
+        return read_amount;
+    }
+
+    // inline files are copied straight out of the inode, up to the end of the file
+    if (inode_flags[load_inode(inode_index)] & INODE_INLINE)
+    {
+        int read_pointer = file_descriptors[fileID].read_pointer;
+        int size = inode_sizes[inode_index];
+
+        memset(buf, 0, length);
+        read_amount = read_pointer >= size ? 0 : (length < size - read_pointer ? length : size - read_pointer);
+        memcpy(buf, get_inode_map(inode_index)->data + read_pointer, read_amount);
+        file_descriptors[fileID].read_pointer += read_amount;
+        free(buffer);
+        return read_amount;
+    }
+
+    // compressed files are read a cluster at a time, up to the end of the file
+    if (inode_flags[inode_index] & INODE_COMPRESSED)
+    {
+        memset(buf, 0, length);
+        read_amount = read_compressed(inode_index, file_descriptors[fileID].read_pointer, buf, length);
+        if (read_amount > 0)
+            file_descriptors[fileID].read_pointer += read_amount;
+        free(buffer);
+        return read_amount;
+    }
+
+    // reads stop at the end of the file, a read pointer past it reads nothing
+    read_pointer = file_descriptors[fileID].read_pointer;
+    size = inode_sizes[inode_index];
+    if (read_pointer >= size)
+    {
+        free(buffer);
+        return 0;
+    }
+    if (length > size - read_pointer)
+        length = size - read_pointer;
+    memset(buf, 0, length);
+
+    while (read_amount < length)
+    {
+        location = (read_pointer + read_amount) % BLOCK_SIZE;
+        copy_amount = BLOCK_SIZE - location;
+        if (copy_amount > length - read_amount)
+            copy_amount = length - read_amount;
+
+        // a hole is not mapped to any block and reads as the zeros already in buf
+        block_index = read_file_block(inode_index, read_pointer + read_amount, buffer);
+        if (block_index != -1)
+            memcpy(buf + read_amount, buffer + location, copy_amount);
+        read_amount += copy_amount;
+    }
+
+    file_descriptors[fileID].read_pointer += read_amount;
+    free(buffer);
+    return read_amount;
+}
+
+// writes length bytes to fileID from buf
+// returns number of bytes written
+int write_file(int fileID, char *buf, int length)
+{
+    int written = 0;
+    int copy_amount;
+    int location;
+    int block_start;
+    int block_index;
+    int allocated = 0;
+    int inode_index;
+    int size;
+    void *buffer;
+
+    if (check_writable("ssfs_fwrite") < 0)
+        return -1;
+
+    // check for invalid length or fileID
+    if (length < 0 || fileID < 0 || fileID >= fd_capacity)
+        return -1;
+    else if (length == 0)
+        return 0;
+
+    // check for a closed file
+    inode_index = get_fd_inode(fileID);
+    if (inode_index == -1)
+    {
+        printf("ERROR (ssfs_fwrite): fd entry was unitialized.\n");
+        return -1;
+    }
+
+    // create a buffer
+    buffer = malloc(BLOCK_SIZE);
+    if (buffer == NULL)
+    {
+        printf("Error (ssfs_fwrite): Could not allocate memory for buffer.\n");
+        return -1;
+    }
+
+    size = inode_sizes[load_inode(inode_index)];
+
+    // a write past the end leaves a hole between the old end and the write pointer
+    if (file_descriptors[fileID].write_pointer > size)
+    {
+        if (grow_file(inode_index, file_descriptors[fileID].write_pointer) < 0)
+        {
+            free(buffer);
+            return -1;
+        }
+        size = inode_sizes[inode_index];
+        allocated = 1;
+    }
+
+    // small files stay in their inode, which is the only block written
+    if (inode_flags[inode_index] & INODE_INLINE)
+    {
+        int end = file_descriptors[fileID].write_pointer + length;
+        if (end <= INLINE_MAX_SIZE)
+        {
+            memcpy(get_inode_map(inode_index)->data + file_descriptors[fileID].write_pointer, buf, length);
+            file_descriptors[fileID].write_pointer = end;
+            if (end > size)
+                inode_sizes[inode_index] = end;
+            write_inode(inode_index);
+            free(buffer);
+            return length;
+        }
+        if (promote_inline(inode_index) < 0)
+        {
+            free(buffer);
+            return -1;
+        }
+        allocated = 1;
+    }
+
+    if (inode_flags[inode_index] & INODE_COMPRESSED)
+    {
+        free(buffer);
+        return write_compressed(fileID, buf, length);
+    }
+
+    // a write reaching the packed tail needs it back in a block of its own
+    if ((inode_flags[inode_index] & INODE_TAIL) && file_descriptors[fileID].write_pointer + length > size - size % BLOCK_SIZE)
+    {
+        if (unpack_tail(inode_index) < 0)
+        {
+            free(buffer);
+            return -1;
+        }
+        allocated = 1;
+    }
+
+    while (written < length)
+    {
+        // get the amount of data to copy into the current block
+        location = file_descriptors[fileID].write_pointer % BLOCK_SIZE;
+        block_start = file_descriptors[fileID].write_pointer - location;
+        if (length - written > BLOCK_SIZE - location)
+            copy_amount = BLOCK_SIZE - location;
+        else
+            copy_amount = length - written;
+
+        // get the block, preallocated blocks are used as is
+        int was_allocated = 0;
+        block_index = map_block_window(inode_index, block_start / BLOCK_SIZE, fileID, &was_allocated);
+        if (block_index == -1)
+        {
+            printf("Could not find an empty block.\n");
+            // an indirect inode may have been claimed before the block ran out
+            allocated = 1;
+            break;
+        }
+        allocated |= was_allocated;
+
+        // whole blocks go straight from the caller's buffer, the others are read-modify-write
+        // with the bytes past the end of the file zeroed instead of read
+        char *data = buf + written;
+        if (copy_amount != BLOCK_SIZE)
+        {
+            if (!was_allocated && block_start < size)
+            {
+                disk_read(block_index, 1, buffer);
+                if (size - block_start < BLOCK_SIZE)
+                    memset(buffer + (size - block_start), 0, BLOCK_SIZE - (size - block_start));
+            }
+            else
+                memset(buffer, 0, BLOCK_SIZE);
+            memcpy(buffer + location, buf + written, copy_amount);
+            data = buffer;
+        }
+
+        // with dedup on, a block already holding the same bytes is shared instead of written
+        uint32_t hash = 0;
+        int dup = -1;
+        if (super_block.dedup)
+        {
+            hash = hash_block(data);
+            dup = dedup_find(data, hash);
+        }
+        if (dup != -1 && dup != block_index)
+        {
+            get_block_shares()[dup]++;
+            block_shares_dirty = 1;
+            release_block(block_index);
+            get_inode_map(get_chain_inode(inode_index, block_start / BLOCK_SIZE, 0))->pointers[(block_start / BLOCK_SIZE) % NUM_POINTERS] = dup;
+            allocated = 1;
+        }
+        else if (dup == -1)
+        {
+            // a block shared with a clone is copied on write
+            int target_index = unshare_block(inode_index, block_start / BLOCK_SIZE, block_index);
+            if (target_index == -1)
+                break;
+            if (target_index != block_index)
+                allocated = 1;
+            disk_write(target_index, 1, data, WRITE_DATA);
+            if (hash != 0)
+                dedup_record(target_index, hash);
+        }
+
+        // update the write pointer and the file size
+        written += copy_amount;
+        file_descriptors[fileID].write_pointer += copy_amount;
+        if (file_descriptors[fileID].write_pointer > size)
+            size = file_descriptors[fileID].write_pointer;
+    }
+
+    // flush the metadata once for the whole write, an overwrite only changes the file's own inode
+    inode_sizes[load_inode(inode_index)] = size;
+    if (allocated)
+    {
+        write_free_bitmap();
+        write_inode_table();
+    }
+    else
+    {
+        write_inode(inode_index);
+        write_block_hashes();
+    }
+
+    // free memory and return
+    free(buffer);
+    if (written < length)
+        return -1;
+    return length;
+}
+
+// finds the first run of length free blocks in the bitmap. like get_unused_block it
+// stays out of the reservation windows unless no run is left outside them
+int get_free_run(int length)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int run = 0;
+
+        for (int i = 0; i < NUM_DATA_BLOCKS; i++)
+        {
+            if (test_bit(free_bits(), i) == 0 && (pass == 1 || !test_bit(reserved_bits, i)))
+            {
+                run++;
+                if (run == length)
+                    return i - length + 1;
+            }
+            else
+                run = 0;
+        }
+    }
+
+    return -1;
+}
+
+// maps data blocks for length bytes starting at offset without writing data
+// or changing the file size. unmapped blocks of the range are taken as one
+// contiguous run when the bitmap has one, block by block otherwise.
+// the bitmap and inode table are flushed once
+int ssfs_fallocate(int fileID, int offset, int length)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fallocate");
+    int inode_index;
+    int first_block;
+    int last_block;
+    int needed = 0;
+    int run_start;
+    int allocated = 0;
+    int ret = 0;
+
+    if (check_writable("ssfs_fallocate") < 0)
+        return -1;
+
+    // check for invalid arguments
+    if (get_fd_inode(fileID) == -1)
+    {
+        printf("ERROR (ssfs_fallocate): invalid fileID.\n");
+        return -1;
+    }
+    if (offset < 0 || length <= 0)
+    {
+        printf("ERROR (ssfs_fallocate): invalid range.\n");
+        return -1;
+    }
+
+    inode_index = file_descriptors[fileID].inode;
+    first_block = offset / BLOCK_SIZE;
+    last_block = (offset + length - 1) / BLOCK_SIZE;
+    if (inode_flags[load_inode(inode_index)] & INODE_COMPRESSED)
+    {
+        printf("ERROR (ssfs_fallocate): compressed files are stored a cluster at a time.\n");
+        return -1;
+    }
+
+    // preallocated blocks belong to a file kept in blocks
+    allocated = promote_inline(inode_index);
+    if (allocated == 0)
+        allocated = unpack_tail(inode_index);
+    if (allocated < 0)
+        return -1;
+
+    // count the blocks that are not mapped yet
+    for (int i = first_block; i <= last_block; i++)
+        if (map_block(inode_index, i, 0, NULL) == -1)
+            needed++;
+    if (needed == 0 && !allocated)
+        return 0;
+
+    run_start = get_free_run(needed);
+    for (int i = first_block; i <= last_block; i++)
+    {
+        int node_index = get_chain_inode(inode_index, i, 1);
+        if (node_index < 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        int *pointer = &get_inode_map(node_index)->pointers[i % NUM_POINTERS];
+        if (*pointer != -1)
+            continue;
+
+        if (run_start != -1)
+            *pointer = run_start++;
+        else
+            *pointer = get_unused_block();
+
+        if (*pointer == -1)
+        {
+            printf("ERROR (ssfs_fallocate): could not find an empty block.\n");
+            ret = -1;
+            break;
+        }
+        set_bit(free_bits(), *pointer);
+        allocated = 1;
+    }
+
+    if (allocated)
+        write_free_bitmap();
+    write_inode_table();
+    return ret;
+}
+
+// sets fileID to size bytes, the blocks past a smaller end are released in one
+// pass and a larger one leaves a hole. the bitmap and inode table are written once
+int ssfs_ftruncate(int fileID, int size)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_ftruncate");
+    int inode_index;
+    int new_blocks;
+
+    if (check_writable("ssfs_ftruncate") < 0)
+        return -1;
+
+    // check for invalid arguments
+    if (get_fd_inode(fileID) == -1)
+    {
+        printf("ERROR (ssfs_ftruncate): invalid fileID.\n");
+        return -1;
+    }
+    inode_index = file_descriptors[fileID].inode;
+    if (size < 0)
+    {
+        printf("ERROR (ssfs_ftruncate): size < 0\n");
+        return -1;
+    }
+
+    // growing leaves a hole past the old end, no block is allocated for it
+    if (size > inode_sizes[load_inode(inode_index)])
+    {
+        int ret = grow_file(inode_index, size);
+        write_free_bitmap();
+        write_inode_table();
+        return ret;
+    }
+
+    // the new last block is cut in place, so the tail goes back to a block first
+    if (unpack_tail(inode_index) < 0)
+        return -1;
+    new_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // a compressed file stores the cluster holding the new end again, cut to its new length
+    if ((inode_flags[inode_index] & INODE_COMPRESSED) && size % CLUSTER_SIZE != 0)
+    {
+        char data[CLUSTER_SIZE];
+        if (load_cluster(inode_index, size / CLUSTER_SIZE, data) < 0 || store_cluster(inode_index, size / CLUSTER_SIZE, data, size % CLUSTER_SIZE) < 0)
+            return -1;
+        free_file_blocks(inode_index, (size / CLUSTER_SIZE + 1) * CLUSTER_BLOCKS);
+    }
+    else
+        free_file_blocks(inode_index, new_blocks);
+    if (inode_flags[inode_index] & INODE_INLINE)
+        memset(get_inode_map(inode_index)->data + size, 0, INLINE_MAX_SIZE - size);
+    inode_sizes[load_inode(inode_index)] = size;
+
+    // pull back every descriptor of the file, mappings lose their released blocks and
+    // read zeros past the new end, which a write back then stores as zeros too
+    for (int i = 0; i < fd_capacity; i++)
+    {
+        if (file_descriptors[i].inode != inode_index)
+            continue;
+        if (file_descriptors[i].read_pointer > size)
+            file_descriptors[i].read_pointer = size;
+        if (file_descriptors[i].write_pointer > size)
+            file_descriptors[i].write_pointer = size;
+        if (file_descriptors[i].map_blocks > new_blocks)
+            file_descriptors[i].map_blocks = new_blocks;
+        if (file_descriptors[i].map != NULL && file_descriptors[i].map_blocks * BLOCK_SIZE > size)
+            memset(file_descriptors[i].map + size, 0, file_descriptors[i].map_blocks * BLOCK_SIZE - size);
+    }
+
+    write_free_bitmap();
+    write_inode_table();
+    return 0;
+}
+
+// switches an empty file to compressed storage, its data is then written in clusters
+// of CLUSTER_BLOCKS blocks, each compressed on its own
+int ssfs_fcompress(int fileID)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fcompress");
+    int inode_index;
+
+    if (check_writable("ssfs_fcompress") < 0)
+        return -1;
+
+    // check for invalid arguments
+    if (get_fd_inode(fileID) == -1)
+    {
+        printf("ERROR (ssfs_fcompress): invalid fileID.\n");
+        return -1;
+    }
+    inode_index = file_descriptors[fileID].inode;
+    if (inode_sizes[load_inode(inode_index)] != 0)
+    {
+        printf("ERROR (ssfs_fcompress): file is not empty.\n");
+        return -1;
+    }
+
+    // an empty inline file has nothing to move, its block map just starts out empty
+    promote_inline(inode_index);
+    inode_flags[inode_index] |= INODE_COMPRESSED;
+    write_inode(inode_index);
+    return 0;
+}
+
+int remove_file(char *file)
+{
+    char leaf[MAX_NAME_LEN + 1];
+    int dir;
+    int inode_index;
+
+    if (check_writable("ssfs_remove") < 0)
+        return -1;
+
+
+    // find the file in its directory
+    if (resolve_path(file, &dir, leaf) < 0)
+        return -1;
+    inode_index = dir_find(dir, leaf, NULL, NULL);
+    if (inode_index < 0)
+    {
+        printf("ERROR (remove): couldn't find file %s\n", file);
+        return -1;
+    }
+    if (inode_flags[load_inode(inode_index)] & INODE_DIR)
+    {
+        printf("ERROR (remove): %s is a directory\n", file);
+        return -1;
+    }
+
+    release_file(inode_index);
+    dir_remove(dir, leaf);
+    write_inode_table();
+    write_free_bitmap();
+    return 0;
+}
+
+// creates dst as a copy of src that shares all of its blocks. only the inodes are
+// copied, each shared block gains an owner and is copied by the first write to it
+int ssfs_clone(char *src, char *dst)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_clone");
+    char leaf[MAX_NAME_LEN + 1];
+    int owners[NUM_DATA_BLOCKS]; // owners the clone adds to each block
+    int dir;
+    int src_index;
+    int dst_index;
+
+    if (check_writable("ssfs_clone") < 0)
+        return -1;
+
+    // find the source and make sure the destination is free
+    if (resolve_path(src, &dir, leaf) < 0)
+        return -1;
+    src_index = dir_find(dir, leaf, NULL, NULL);
+    if (src_index < 0 || (inode_flags[load_inode(src_index)] & INODE_DIR))
+    {
+        printf("ERROR (ssfs_clone): couldn't find file %s\n", src);
+        return -1;
+    }
+    if (resolve_path(dst, &dir, leaf) < 0)
+        return -1;
+    if (dir_find(dir, leaf, NULL, NULL) >= 0)
+    {
+        printf("ERROR (ssfs_clone): %s already exists\n", dst);
+        return -1;
+    }
+
+    // a block can only take so many owners. with dedup one file can point at the same
+    // block many times, so the owners the clone adds are counted per block first
+    memset(owners, 0, sizeof(owners));
+    for (int node = src_index; node != -1 && !(inode_flags[src_index] & INODE_INLINE); node = get_inode_map(node)->ind_pointer)
+        for (int i = 0; i < NUM_POINTERS; i++)
+            if (get_inode_map(node)->pointers[i] != -1)
+                owners[get_inode_map(node)->pointers[i]]++;
+    if (inode_flags[src_index] & INODE_TAIL)
+        owners[get_inode_map(src_index)->tail_block]++;
+    for (int k = 0; k < NUM_DATA_BLOCKS; k++)
+    {
+        if (get_block_shares()[k] + owners[k] > MAX_BLOCK_SHARES)
+        {
+            printf("ERROR (ssfs_clone): block %i has too many owners.\n", k);
+            return -1;
+        }
+    }
+
+    dst_index = get_unused_inode();
+    if (dst_index < 0)
+    {
+        printf("ERROR (ssfs_clone): could not find an empty inode.\n");
+        return -1;
+    }
+    inode_sizes[load_inode(dst_index)] = inode_sizes[load_inode(src_index)];
+    inode_flags[load_inode(dst_index)] = inode_flags[src_index] & INODE_COMPRESSED;
+
+    // an inline file is copied whole, it has no blocks to share
+    if (inode_flags[src_index] & INODE_INLINE)
+    {
+        *get_inode_map(dst_index) = *get_inode_map(src_index);
+        inode_flags[dst_index] = INODE_INLINE;
+        if (dir_insert(dir, leaf, dst_index) < 0)
+        {
+            printf("ERROR (ssfs_clone): could not find an empty directory slot.\n");
+            release_inode(dst_index);
+            return -1;
+        }
+        write_inode(dst_index);
+        return 0;
+    }
+
+    // copy the chain of block maps, the blocks themselves stay where they are
+    int src_node = src_index;
+    int dst_node = dst_index;
+    while (1)
+    {
+        memcpy(get_inode_map(dst_node)->pointers, get_inode_map(src_node)->pointers, sizeof(get_inode_map(dst_node)->pointers));
+        get_inode_map(dst_node)->ind_pointer = -1;
+        for (int i = 0; i < NUM_POINTERS; i++)
+        {
+            if (get_inode_map(dst_node)->pointers[i] != -1)
+            {
+                get_block_shares()[get_inode_map(dst_node)->pointers[i]]++;
+                block_shares_dirty = 1;
+            }
+        }
+
+        src_node = get_inode_map(src_node)->ind_pointer;
+        if (src_node == -1)
+            break;
+
+        int ind_inode_index = get_unused_inode();
+        if (ind_inode_index < 0)
+        {
+            printf("ERROR (ssfs_clone): could not find an empty inode for new indirect pointer.\n");
+            release_file(dst_index);
+            return -1;
+        }
+        inode_sizes[load_inode(ind_inode_index)] = 0;
+        inode_flags[load_inode(ind_inode_index)] = 0;
+        get_inode_map(dst_node)->ind_pointer = ind_inode_index;
+        dst_node = ind_inode_index;
+    }
+
+    // a packed tail gains an owner like any other block
+    if (inode_flags[src_index] & INODE_TAIL)
+    {
+        get_inode_map(dst_index)->tail_block = get_inode_map(src_index)->tail_block;
+        get_inode_map(dst_index)->tail_offset = get_inode_map(src_index)->tail_offset;
+        inode_flags[dst_index] |= INODE_TAIL;
+        get_block_shares()[get_inode_map(dst_index)->tail_block]++;
+        block_shares_dirty = 1;
+    }
+
+    if (dir_insert(dir, leaf, dst_index) < 0)
+    {
+        printf("ERROR (ssfs_clone): could not find an empty directory slot.\n");
+        release_file(dst_index);
+        return -1;
+    }
+    write_inode_table();
+    write_free_bitmap();
+    return 0;
+}
+
+// freezes the super block, inode table and root directory as a read-only snapshot and
+// returns its number. every block in use gains an owner, so the live volume copies a
+// block on its next write and the snapshot keeps the old data
+int ssfs_snapshot()
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_snapshot");
+    char *buffer;
+    int snapshot;
+    int start;
+    int owners[NUM_DATA_BLOCKS]; // owners the snapshot adds to each block
+
+    if (check_writable("ssfs_snapshot") < 0)
+        return -1;
+    for (snapshot = 0; snapshot < MAX_SNAPSHOTS; snapshot++)
+        if (super_block.snapshots[snapshot] == -1)
+            break;
+    if (snapshot == MAX_SNAPSHOTS)
+    {
+        printf("ERROR (ssfs_snapshot): already at maximum amount of snapshots.\n");
+        return -1;
+    }
+
+    // the whole inode table and root directory go into the snapshot
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+        load_inode(b * INODES_PER_BLOCK);
+    load_root_dir();
+    memset(owners, 0, sizeof(owners));
+    for (int i = 0; i < NUM_INODES; i++)
+    {
+        inode_map_t *map = &inode_maps[i / INODES_PER_BLOCK][i % INODES_PER_BLOCK];
+        for (int j = 0; inode_sizes[i] != -1 && !(inode_flags[i] & INODE_INLINE) && j < NUM_POINTERS; j++)
+            if (map->pointers[j] != -1)
+                owners[map->pointers[j]]++;
+        if (inode_sizes[i] != -1 && (inode_flags[i] & INODE_TAIL))
+            owners[map->tail_block]++;
+    }
+    // a tail block gains one owner per packed tail
+    for (int k = 0; k < NUM_DATA_BLOCKS; k++)
+    {
+        if (get_block_shares()[k] + owners[k] > MAX_BLOCK_SHARES)
+        {
+            printf("ERROR (ssfs_snapshot): block %i has too many owners.\n", k);
             return -1;
         }
+    }
+
+    buffer = calloc(SNAPSHOT_BLOCKS, BLOCK_SIZE);
+    start = get_free_run(SNAPSHOT_BLOCKS);
+    if (buffer == NULL || start == -1)
+    {
+        printf("ERROR (ssfs_snapshot): could not find room for the snapshot.\n");
+        free(buffer);
+        return -1;
+    }
+    for (int k = 0; k < SNAPSHOT_BLOCKS; k++)
+        set_bit(free_bits(), start + k);
+
+    for (int k = 0; k < NUM_DATA_BLOCKS; k++)
+        block_shares[k] += owners[k];
+    block_shares_dirty = 1;
+
+    // super block copy pointing at the frozen tables, then the tables themselves
+    super_block_t *copy = (super_block_t *)buffer;
+    *copy = super_block;
+    copy->inode_start = start + 1;
+    copy->root_start = start + 1 + NUM_INODE_BLOCKS;
+    for (int i = 0; i < MAX_SNAPSHOTS; i++)
+        copy->snapshots[i] = -1;
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+        pack_inode_block(b, (inode_t *)(buffer + (1 + b) * BLOCK_SIZE));
+    memcpy(buffer + (1 + NUM_INODE_BLOCKS) * BLOCK_SIZE, root_dir, ROOT_DIR_BLOCKS * BLOCK_SIZE);
+    disk_write(start, SNAPSHOT_BLOCKS, buffer, WRITE_METADATA);
+    free(buffer);
+
+    super_block.snapshots[snapshot] = start;
+    write_super_block();
+    write_free_bitmap();
+    return snapshot;
+}
+
+// turns dedup on or off for the volume. while it is on, every block ssfs_fwrite writes
+// is fingerprinted and shared with a block holding the same bytes when there is one
+int ssfs_set_dedup(int enabled)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_set_dedup");
+    if (check_writable("ssfs_set_dedup") < 0)
+        return -1;
+
+    super_block.dedup = enabled != 0;
+    write_super_block();
+    return 0;
+}
+
+// deletes a snapshot, dropping its ownership of every block it references
+int ssfs_snapshot_delete(int snapshot)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_snapshot_delete");
+    inode_t *inodes;
+    int start;
+
+    if (check_writable("ssfs_snapshot_delete") < 0)
+        return -1;
+    if (snapshot < 0 || snapshot >= MAX_SNAPSHOTS || super_block.snapshots[snapshot] == -1)
+    {
+        printf("ERROR (ssfs_snapshot_delete): no snapshot %i.\n", snapshot);
+        return -1;
+    }
+    start = super_block.snapshots[snapshot];
 
-        // get the index of an unsused directory slot
-        directory_index = get_unused_dir_slot();
-        if (directory_index < 0)
+    inodes = malloc(NUM_INODE_BLOCKS * BLOCK_SIZE);
+    if (inodes == NULL)
+    {
+        printf("ERROR (ssfs_snapshot_delete): could not allocate memory for buffer.\n");
+        return -1;
+    }
+    disk_read(start + 1, NUM_INODE_BLOCKS, inodes);
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+    {
+        inode_t *disk = inodes + b * INODES_PER_BLOCK;
+        for (int i = 0; i < inodes_in_block(b); i++)
         {
-            printf("ERROR (ssfs_open): could not find an empty directory slot.\n");
+            for (int j = 0; disk[i].size != -1 && !(disk[i].flags & INODE_INLINE) && j < NUM_POINTERS; j++)
+                if (disk[i].pointers[j] != -1)
+                    release_block(disk[i].pointers[j]);
+            if (disk[i].size != -1 && (disk[i].flags & INODE_TAIL))
+                release_block(disk[i].tail_block);
+        }
+    }
+    free(inodes);
+
+    for (int k = 0; k < SNAPSHOT_BLOCKS; k++)
+        clear_bit(free_bits(), start + k);
+    super_block.snapshots[snapshot] = -1;
+    write_super_block();
+    write_free_bitmap();
+    return 0;
+}
+
+// marks the inodes in use that only continue another inode's block map
+void find_chain_inodes(int *chained)
+{
+    memset(chained, 0, NUM_INODES * sizeof(int));
+    for (int i = 0; i < NUM_INODES; i++)
+        if (inode_sizes[load_inode(i)] != -1 && get_inode_map(i)->ind_pointer != -1)
+            chained[get_inode_map(i)->ind_pointer] = 1;
+}
+
+// lists the mapped blocks of a file in file order and returns how many there are,
+// -1 if one of them is shared and cannot move
+int list_file_blocks(int inode_index, int *blocks)
+{
+    int nblocks = 0;
+
+    if (inode_flags[load_inode(inode_index)] & INODE_INLINE)
+        return 0;
+    for (int node = inode_index; node != -1; node = get_inode_map(node)->ind_pointer)
+    {
+        for (int i = 0; i < NUM_POINTERS; i++)
+        {
+            int block_index = get_inode_map(node)->pointers[i];
+            if (block_index == -1)
+                continue;
+            if (get_block_shares()[block_index] > 0)
+                return -1;
+            blocks[nblocks++] = block_index;
+        }
+    }
+    return nblocks;
+}
+
+// percentage of the block to block steps inside files that are not to the next block
+int ssfs_frag_score()
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_frag_score");
+    int chained[NUM_INODES];
+    int blocks[NUM_DATA_BLOCKS];
+    int steps = 0;
+    int breaks = 0;
+
+    find_chain_inodes(chained);
+    for (int i = 0; i < NUM_INODES; i++)
+    {
+        if (inode_sizes[i] == -1 || chained[i])
+            continue;
+        int nblocks = 0;
+        for (int node = i; node != -1 && !(inode_flags[i] & INODE_INLINE); node = get_inode_map(node)->ind_pointer)
+            for (int j = 0; j < NUM_POINTERS; j++)
+                if (get_inode_map(node)->pointers[j] != -1)
+                    blocks[nblocks++] = get_inode_map(node)->pointers[j];
+        for (int k = 1; k < nblocks; k++)
+            breaks += blocks[k] != blocks[k - 1] + 1;
+        steps += nblocks > 1 ? nblocks - 1 : 0;
+    }
+    return steps == 0 ? 0 : breaks * 100 / steps;
+}
+
+// moves the blocks of a file to the free run at start, in file order. the copies and
+// their bitmap bits are written first, then the block maps, then the old blocks are
+// freed, so an interruption leaves either the old or the new layout
+int relocate_file(int inode_index, int *blocks, int nblocks, int start)
+{
+    TRACE_SCOPE("relocate_file");
+    char *buffer = malloc(nblocks * BLOCK_SIZE);
+    int k = 0;
+
+    if (buffer == NULL)
+    {
+        printf("ERROR (relocate_file): could not allocate memory for buffer.\n");
+        return -1;
+    }
+    for (int i = 0; i < nblocks; i++)
+        disk_read(blocks[i], 1, buffer + i * BLOCK_SIZE);
+    disk_write(start, nblocks, buffer, file_write_kind(inode_index));
+    free(buffer);
+    for (int i = 0; i < nblocks; i++)
+        set_bit(free_bits(), start + i);
+    write_free_bitmap();
+
+    for (int node = inode_index; node != -1; node = get_inode_map(node)->ind_pointer)
+        for (int i = 0; i < NUM_POINTERS; i++)
+            if (get_inode_map(node)->pointers[i] != -1)
+                get_inode_map(node)->pointers[i] = start + k++;
+    write_inode_table();
+
+    // fingerprints follow their blocks
+    for (int i = 0; i < nblocks; i++)
+    {
+        if (get_block_hashes()[blocks[i]] != 0)
+            dedup_record(start + i, block_hashes[blocks[i]]);
+        release_block(blocks[i]);
+    }
+    write_free_bitmap();
+    return 0;
+}
+
+// defragments the volume a file at a time. a file is moved to the lowest free run that
+// holds all of its blocks when its blocks are not contiguous, or when that run starts
+// below it, which compacts the used blocks toward the start of the data region.
+// files with shared blocks stay where they are. with max_blocks 0 the whole volume is
+// done, passing over it until nothing moves; otherwise the call stops once max_blocks
+// blocks have moved and the next call resumes after the last file it looked at.
+// returns the number of blocks moved, stats gets the scores before and after
+int ssfs_defrag(int max_blocks, ssfs_defrag_stats_t *stats)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_defrag");
+    int chained[NUM_INODES];
+    int blocks[NUM_DATA_BLOCKS];
+    int moved = 0;
+    int files = 0;
+    int score_before;
+
+    if (check_writable("ssfs_defrag") < 0)
+        return -1;
+    if (max_blocks < 0)
+    {
+        printf("ERROR (ssfs_defrag): max_blocks < 0\n");
+        return -1;
+    }
+
+    score_before = ssfs_frag_score();
+    find_chain_inodes(chained);
+    while (1)
+    {
+        int pass_moved = 0;
+        for (int n = 0; n < NUM_INODES; n++)
+        {
+            int i = defrag_cursor;
+            defrag_cursor = (defrag_cursor + 1) % NUM_INODES;
+            if (inode_sizes[load_inode(i)] == -1 || chained[i])
+                continue;
+
+            int nblocks = list_file_blocks(i, blocks);
+            if (nblocks <= 0)
+                continue;
+            int contiguous = 1;
+            for (int k = 1; k < nblocks && contiguous; k++)
+                contiguous = blocks[k] == blocks[k - 1] + 1;
+
+            int start = get_free_run(nblocks);
+            if (start == -1 || (contiguous && start > blocks[0]))
+                continue;
+            if (max_blocks > 0 && moved > 0 && moved + nblocks > max_blocks)
+            {
+                // leave the file for the next call
+                defrag_cursor = i;
+                break;
+            }
+            if (relocate_file(i, blocks, nblocks, start) < 0)
+                return -1;
+            moved += nblocks;
+            pass_moved += nblocks;
+            files++;
+            if (max_blocks > 0 && moved >= max_blocks)
+                break;
+        }
+        if (max_blocks > 0 || pass_moved == 0)
+            break;
+    }
+
+    if (stats != NULL)
+    {
+        stats->score_before = score_before;
+        stats->score_after = ssfs_frag_score();
+        stats->files_moved = files;
+        stats->blocks_moved = moved;
+    }
+    return moved;
+}
+
+// microseconds on the monotonic clock
+uint64_t now_us()
+{
+    return now_ns() / 1000;
+}
+
+// fills stats with the block and inode usage of the mounted volume and the counters
+// of every measured operation
+int ssfs_statfs(ssfs_statfs_t *stats)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_statfs");
+    if (stats == NULL)
+    {
+        printf("ERROR (ssfs_statfs): stats is NULL.\n");
+        return -1;
+    }
+
+    stats->total_blocks = NUM_DATA_BLOCKS - FIRST_DATA_BLOCK;
+    stats->free_blocks = 0;
+    for (int b = FIRST_DATA_BLOCK; b < NUM_DATA_BLOCKS; b++)
+        if (!test_bit(free_bits(), b))
+            stats->free_blocks++;
+
+    stats->total_inodes = NUM_INODES;
+    stats->free_inodes = 0;
+    for (int i = 0; i < NUM_INODES; i++)
+        if (inode_sizes[load_inode(i)] == -1)
+            stats->free_inodes++;
+
+    stats->open_files = 0;
+    for (int j = 0; j < fd_capacity; j++)
+        if (file_descriptors[j].inode != -1)
+            stats->open_files++;
+
+    stats->frag_score = ssfs_frag_score();
+    memcpy(stats->ops, op_stats, sizeof(op_stats));
+    return 0;
+}
+
+// appends the state of the volume to the export file as one JSON object per line,
+// stamped with the wall clock time in milliseconds
+void export_stats(uint64_t now)
+{
+    TRACE_SCOPE("export_stats");
+    ssfs_statfs_t stats;
+    struct timespec ts;
+
+    stats_next_export = now + (uint64_t)stats_interval_ms * 1000;
+    if (ssfs_statfs(&stats) < 0)
+        return;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    fprintf(stats_file, "{\"time_ms\": %llu, \"total_blocks\": %i, \"free_blocks\": %i, \"total_inodes\": %i, \"free_inodes\": %i, \"frag_score\": %i, \"open_files\": %i, \"ops\": {",
+            (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000, stats.total_blocks, stats.free_blocks,
+            stats.total_inodes, stats.free_inodes, stats.frag_score, stats.open_files);
+    for (int op = 0; op < SSFS_STAT_NUM_OPS; op++)
+    {
+        ssfs_op_stats_t *o = &stats.ops[op];
+        fprintf(stats_file, "%s\"%s\": {\"calls\": %llu, \"errors\": %llu, \"bytes\": %llu, \"blocks_read\": %llu, \"blocks_written\": %llu, \"metadata_writes\": %llu, \"latency_us\": [",
+                op > 0 ? ", " : "", stat_op_names[op], (unsigned long long)o->calls, (unsigned long long)o->errors, (unsigned long long)o->bytes,
+                (unsigned long long)o->blocks_read, (unsigned long long)o->blocks_written, (unsigned long long)o->metadata_writes);
+        for (int b = 0; b < SSFS_LATENCY_BUCKETS; b++)
+            fprintf(stats_file, "%s%llu", b > 0 ? ", " : "", (unsigned long long)o->latency[b]);
+        fprintf(stats_file, "]}");
+    }
+    fprintf(stats_file, "}}\n");
+    fflush(stats_file);
+}
+
+// appends the output of ssfs_statfs to the file at path now and then whenever a
+// measured operation ends interval_ms or more after the last export. the export runs
+// on the caller's thread like the rest of the file system. a NULL path stops it
+int ssfs_stats_export(char *path, int interval_ms)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_stats_export");
+    if (stats_file != NULL)
+    {
+        fclose(stats_file);
+        stats_file = NULL;
+    }
+    if (path == NULL)
+        return 0;
+    if (interval_ms < 0)
+    {
+        printf("ERROR (ssfs_stats_export): interval_ms < 0\n");
+        return -1;
+    }
+
+    stats_file = fopen(path, "a");
+    if (stats_file == NULL)
+    {
+        printf("ERROR (ssfs_stats_export): could not open %s.\n", path);
+        return -1;
+    }
+    stats_interval_ms = interval_ms;
+    export_stats(now_us());
+    return 0;
+}
+
+// records the clock and the disk counters before a measured operation
+void stats_begin(op_start_t *start)
+{
+    start->blocks_read = disk_blocks_read;
+    start->blocks_written = disk_blocks_written;
+    start->metadata_writes = disk_metadata_writes;
+    start->start_us = now_us();
+}
+
+// charges a finished operation with its latency and the blocks transferred since
+// stats_begin, the bytes are what fread and fwrite returned
+void stats_end(ssfs_stat_op_t op, op_start_t *start, int ret)
+{
+    ssfs_op_stats_t *stats = &op_stats[op];
+    uint64_t now = now_us();
+    uint64_t elapsed = now - start->start_us;
+    int bucket = 0;
+
+    while (bucket < SSFS_LATENCY_BUCKETS - 1 && elapsed >= (1ull << bucket))
+        bucket++;
+    stats->latency[bucket]++;
+    stats->calls++;
+    if (ret == -1)
+        stats->errors++;
+    else if (op == SSFS_STAT_FREAD || op == SSFS_STAT_FWRITE)
+        stats->bytes += ret;
+    stats->blocks_read += disk_blocks_read - start->blocks_read;
+    stats->blocks_written += disk_blocks_written - start->blocks_written;
+    stats->metadata_writes += disk_metadata_writes - start->metadata_writes;
+
+    if (stats_file != NULL && now >= stats_next_export)
+        export_stats(now);
+}
+
+// the measured entry points, each runs the operation between stats_begin and stats_end
+int ssfs_fopen(char *name)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fopen");
+    op_start_t start;
+    stats_begin(&start);
+    int ret = open_file(name);
+    stats_end(SSFS_STAT_FOPEN, &start, ret);
+    return ret;
+}
+
+int ssfs_fread(int fileID, char *buf, int length)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fread");
+    op_start_t start;
+    stats_begin(&start);
+    int ret = read_file(fileID, buf, length);
+    stats_end(SSFS_STAT_FREAD, &start, ret);
+    return ret;
+}
+
+int ssfs_fwrite(int fileID, char *buf, int length)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fwrite");
+    op_start_t start;
+    stats_begin(&start);
+    int ret = write_file(fileID, buf, length);
+    stats_end(SSFS_STAT_FWRITE, &start, ret);
+    return ret;
+}
+
+int ssfs_remove(char *file)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_remove");
+    op_start_t start;
+    stats_begin(&start);
+    int ret = remove_file(file);
+    stats_end(SSFS_STAT_REMOVE, &start, ret);
+    return ret;
+}
+
+int ssfs_frseek(int fileID, int loc)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_frseek");
+    op_start_t start;
+    stats_begin(&start);
+    int ret = seek_read(fileID, loc);
+    stats_end(SSFS_STAT_FRSEEK, &start, ret);
+    return ret;
+}
+
+int ssfs_fwseek(int fileID, int loc)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_fwseek");
+    op_start_t start;
+    stats_begin(&start);
+    int ret = seek_write(fileID, loc);
+    stats_end(SSFS_STAT_FWSEEK, &start, ret);
+    return ret;
+}
+
+// a name of a batch removal, resolved to its directory and the name inside it
+typedef struct
+{
+    int dir;
+    uint32_t hash;
+    int len;
+    int index; // of the name in the caller's list
+    char leaf[MAX_NAME_LEN + 1];
+} batch_key_t;
+
+// orders batch keys by directory and then by hash for qsort/bsearch
+int compare_keys(const void *a, const void *b)
+{
+    const batch_key_t *x = a;
+    const batch_key_t *y = b;
+
+    if (x->dir != y->dir)
+        return x->dir < y->dir ? -1 : 1;
+    return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+// removes the files of directory dir named by keys, which all belong to dir, with a single
+// pass over its dirent blocks. each block is written at most once, the caller flushes the
+// inode table and bitmap. returns the number of files removed
+int remove_from_dir(int dir, batch_key_t *keys, int count, int *results)
+{
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    int nblocks = dir_num_blocks(dir);
+    int removed = 0;
+
+    for (int b = 0; b < nblocks; b++)
+    {
+        int dirty = 0;
+
+        if (read_dir_block(dir, b, entries) < 0)
+            break;
+        for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            if (entries[i].inode < 0 || (inode_flags[load_inode(entries[i].inode)] & INODE_DIR))
+                continue;
+
+            batch_key_t probe;
+            probe.dir = dir;
+            probe.hash = entries[i].hash;
+            batch_key_t *key = bsearch(&probe, keys, count, sizeof(batch_key_t), compare_keys);
+            if (key == NULL)
+                continue;
+
+            // walk back to the first key with this hash, then check each of them
+            while (key > keys && (key - 1)->hash == probe.hash)
+                key--;
+            for (; key < keys + count && key->hash == probe.hash; key++)
+            {
+                if (dirent_matches(&entries[i], key->leaf, key->len, key->hash))
+                {
+                    if (results != NULL)
+                        results[key->index] = 0;
+                    release_file(entries[i].inode);
+                    clear_dirent(entries, i);
+                    dirty = 1;
+                    removed++;
+                    break;
+                }
+            }
+        }
+        if (dirty)
+            write_dir_block(dir, b, entries);
+    }
+
+    return removed;
+}
+
+// removes every file named in files, paths are resolved like ssfs_remove does. the names
+// are grouped by directory and each directory is read in a single pass, the inode table,
+// bitmap and each touched dirent block are written once for the whole batch.
+// results, when not NULL, gets 0 for each name removed and -1 for each one that was not
+// (missing, a directory or a repeat). returns the number of files removed
+int ssfs_remove_batch(char **files, int count, int *results)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_remove_batch");
+    batch_key_t *keys;
+    int num_keys = 0;
+    int removed = 0;
+
+    if (check_writable("ssfs_remove_batch") < 0)
+        return -1;
+
+    if (files == NULL || count < 0)
+    {
+        printf("ERROR (ssfs_remove_batch): invalid file list.\n");
+        return -1;
+    }
+    if (count == 0)
+        return 0;
+
+    keys = calloc(count, sizeof(batch_key_t));
+    if (keys == NULL)
+    {
+        printf("ERROR (ssfs_remove_batch): could not allocate memory for names.\n");
+        return -1;
+    }
+    // every path is resolved before anything is removed, only files are removed so the
+    // directories found stay valid
+    for (int i = 0; i < count; i++)
+    {
+        batch_key_t *key = &keys[num_keys];
+
+        if (results != NULL)
+            results[i] = -1;
+        if (files[i] == NULL || resolve_path(files[i], &key->dir, key->leaf) < 0)
+            continue;
+        key->len = strlen(key->leaf);
+        key->hash = hash_name(key->leaf, key->len);
+        key->index = i;
+        num_keys++;
+    }
+    qsort(keys, num_keys, sizeof(batch_key_t), compare_keys);
+
+    for (int first = 0; first < num_keys;)
+    {
+        int last = first;
+        while (last < num_keys && keys[last].dir == keys[first].dir)
+            last++;
+        removed += remove_from_dir(keys[first].dir, keys + first, last - first, results);
+        first = last;
+    }
+    free(keys);
+
+    if (removed > 0)
+    {
+        write_inode_table();
+        write_free_bitmap();
+    }
+    return removed;
+}
+
+// removes every file of a directory whose name starts with the last component of prefix,
+// "logs/2019-" removes the files in logs starting with "2019-" and "logs/" all of them.
+// files of deeper directories are left alone. metadata is written once.
+// returns the number of files removed
+int ssfs_remove_prefix(char *prefix)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_remove_prefix");
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    char name[MAX_NAME_LEN + 1];
+    int dir = ROOT_DIR;
+    int removed = 0;
+    int len;
+
+    if (check_writable("ssfs_remove_prefix") < 0)
+        return -1;
+
+    if (prefix == NULL)
+    {
+        printf("ERROR (ssfs_remove_prefix): invalid prefix.\n");
+        return -1;
+    }
+
+    // the part up to the last slash names the directory
+    char *slash = strrchr(prefix, '/');
+    if (slash != NULL)
+    {
+        int path_len = slash - prefix;
+        char *path = malloc(path_len + 1);
+        if (path == NULL)
+        {
+            printf("ERROR (ssfs_remove_prefix): could not allocate memory for the path.\n");
             return -1;
         }
-
-        // update inode table, file descriptor table, super block
-        int len = strlen(name);
-        if (len > MAX_FILENAME - 1)
-            len = MAX_FILENAME - 1;
-        inode_table[inode_index].size = 0;
-        file_descriptors[fd_index].inode = inode_index;
-        memcpy(file_descriptors[fd_index].name, name, len);
-        memcpy(&super_block.root[directory_index].name, name, len);
-        super_block.root[directory_index].inode = inode_index;
-        write_super_block();
-        write_inode_table();
-        // printf("fopen(): super_block.root[directory_index].inode = %i\n", super_block.root[directory_index].inode);
-        // printf("fopen(): super_block.root[directory_index].name = %s\n", super_block.root[directory_index].name);
+        memcpy(path, prefix, path_len);
+        path[path_len] = '\0';
+
+        // only slashes is the root
+        if (path[strspn(path, "/")] != '\0')
+        {
+            int parent;
+            if (resolve_path(path, &parent, name) < 0)
+                dir = -1;
+            else
+                dir = dir_find(parent, name, NULL, NULL);
+            if (dir < 0 || !(inode_flags[load_inode(dir)] & INODE_DIR))
+            {
+                printf("ERROR (ssfs_remove_prefix): %s is not a directory.\n", path);
+                free(path);
+                return -1;
+            }
+        }
+        free(path);
+        prefix = slash + 1;
+    }
+    len = strlen(prefix);
+
+    for (int b = 0; b < dir_num_blocks(dir); b++)
+    {
+        int dirty = 0;
+
+        if (read_dir_block(dir, b, entries) < 0)
+            break;
+        for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            if (entries[i].inode < 0 || (inode_flags[load_inode(entries[i].inode)] & INODE_DIR))
+                continue;
+            if (entries[i].name_len < len || read_name(&entries[i], name) < 0)
+                continue;
+            if (strncmp(name, prefix, len) == 0)
+            {
+                release_file(entries[i].inode);
+                clear_dirent(entries, i);
+                dirty = 1;
+                removed++;
+            }
+        }
+        if (dirty)
+            write_dir_block(dir, b, entries);
     }
-    // if the file was already exists on the disk
-    else
+
+    if (removed > 0)
     {
-        // printf("file with name '%s' already exists on disk, opening existing file...\n", name);
-        // get inode from directory entry and initialize file descriptor
-        int len = strlen(name);
-        if (len > MAX_FILENAME - 1)
-            len = MAX_FILENAME - 1;
-        inode_index = super_block.root[directory_index].inode;
-        memcpy(file_descriptors[fd_index].name, name, len);
-        file_descriptors[fd_index].inode = super_block.root[directory_index].inode;
-        file_descriptors[fd_index].write_pointer = inode_table[inode_index].size;
+        write_inode_table();
+        write_free_bitmap();
     }
-
-    return fd_index;
+    return removed;
 }
 
-int ssfs_fclose(int fileID)
+// creates an empty directory with a single dirent block
+int ssfs_mkdir(char *path)
 {
-    // check for invalid fileID
-    if (fileID > MAX_FD_ENTRY)
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_mkdir");
+    char leaf[MAX_NAME_LEN + 1];
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    int dir;
+    int inode_index;
+
+    if (check_writable("ssfs_mkdir") < 0)
+        return -1;
+
+    if (resolve_path(path, &dir, leaf) < 0)
+        return -1;
+    if (dir_find(dir, leaf, NULL, NULL) >= 0)
     {
-        printf("fclose(): fileID > MAX_FD_ENTRY\n");
+        printf("ERROR (ssfs_mkdir): %s already exists.\n", path);
         return -1;
     }
-    else if (fileID < 0)
+
+    inode_index = get_unused_inode();
+    if (inode_index < 0)
     {
-        printf("fclose(): fileID < 0\n");
+        printf("ERROR (ssfs_mkdir): could not find an empty inode.\n");
         return -1;
     }
-    else if (file_descriptors[fileID].inode == -1)
+    inode_sizes[load_inode(inode_index)] = BLOCK_SIZE;
+    inode_flags[load_inode(inode_index)] = INODE_DIR;
+    if (map_block(inode_index, 0, 1, NULL) == -1)
     {
-        printf("fclose(): file_descriptors[fileID].inode == -1\n");
+        printf("ERROR (ssfs_mkdir): could not find an empty block.\n");
+        release_inode(inode_index);
         return -1;
     }
-    else
-    {
-        // check for empty file...
-        if (inode_table[file_descriptors[fileID].inode].size == 0)
-        {
-            inode_table[file_descriptors[fileID].inode].size = 0;
-            write_inode_table();
-        }
 
-        // printf("fclose(): closing file #%i...\n", fileID);
-        // reset the memory of the appropriate entry
-        memset(&file_descriptors[fileID].name, 0, MAX_FILENAME);
-        file_descriptors[fileID].inode = -1;
-        file_descriptors[fileID].read_pointer = 0;
-        file_descriptors[fileID].write_pointer = 0;
-        return 0;
+    for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+    {
+        memset(&entries[i], 0, sizeof(dirent_t));
+        entries[i].inode = DIRENT_EMPTY;
     }
-}
-
-// recursively resets a file's inode_table
-void reset_file_inodes(inode_t node)
-{
-    if (node.ind_pointer != -1)
-        reset_file_inodes(inode_table[node.ind_pointer]);
+    write_dir_block(inode_index, 0, entries);
 
-    for (int i = 0; i < NUM_POINTERS; i++)
+    if (dir_insert(dir, leaf, inode_index) < 0)
     {
-        clear_bit(free_bitmap.bits, node.pointers[i]);
-        node.pointers[i] = -1;
+        free_file_blocks(inode_index, 0);
+        release_inode(inode_index);
+        return -1;
     }
-    node.size = -1;
-    node.ind_pointer = -1;
     write_free_bitmap();
     write_inode_table();
+    return 0;
 }
 
-// moves the read pointer
-int ssfs_frseek(int fileID, int loc)
+// removes an empty directory
+int ssfs_rmdir(char *path)
 {
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_rmdir");
+    char leaf[MAX_NAME_LEN + 1];
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    int dir;
+    int inode_index;
 
-    // check for invalid value
-    if (loc < 0)
+    if (check_writable("ssfs_rmdir") < 0)
+        return -1;
+
+    if (resolve_path(path, &dir, leaf) < 0)
+        return -1;
+    inode_index = dir_find(dir, leaf, NULL, NULL);
+    if (inode_index < 0 || !(inode_flags[load_inode(inode_index)] & INODE_DIR))
     {
-        printf("ERROR (frseek): loc < 0\n");
+        printf("ERROR (ssfs_rmdir): %s is not a directory.\n", path);
         return -1;
     }
-    // removing this doesn't change anyhing
-    // else if (fileID < 0)
-    // {
-    //     printf("ERROR (frseek): fileID < 0\n");
-    //     return -1;
-    // }
-
-    // get the inode index
-    int index = file_descriptors[fileID].inode;
 
-    // check for invalid size
-    if (loc > inode_table[index].size)
+    for (int b = 0; b < inode_sizes[load_inode(inode_index)] / BLOCK_SIZE; b++)
     {
-        printf("ERROR (frseek): loc > file_descriptors[fileID].inode.size\n");
-        return -1;
+        if (read_dir_block(inode_index, b, entries) < 0)
+            return -1;
+        for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            if (entries[i].inode >= 0)
+            {
+                printf("ERROR (ssfs_rmdir): %s is not empty.\n", path);
+                return -1;
+            }
+        }
     }
 
-    file_descriptors[fileID].read_pointer = loc;
+    free_file_blocks(inode_index, 0);
+    release_inode(inode_index);
+    dir_remove(dir, leaf);
+    write_free_bitmap();
+    write_inode_table();
     return 0;
 }
 
-// moves the write pointer
-int ssfs_fwseek(int fileID, int loc)
+// gets the name of the entry of directory path following *cookie, which
+// should start at 0. fname needs room for MAX_NAME_LEN + 1 bytes.
+// the cookie is a dirent slot, so removing entries during a listing is safe. a
+// create that makes a subdirectory grow moves its entries to new slots and a
+// cookie taken before it is no longer valid, the listing has to restart at 0.
+// the root never grows, an entry created in it while listing may or may not show.
+// returns 1 with fname filled, 0 past the last entry
+int ssfs_readdir(char *path, int *cookie, char *fname)
 {
-    // check for invalid value
-    if (loc < 0)
-    {
-        printf("ERROR (fwseek): loc < 0\n");
-        return -1;
-    }
-    // doensn't change anything if removed
-    // else if (fileID < 0)
-    // {
-    //     printf("ERORR (fwseek): fileID < 0\n");
-    //     return -1;
-    // }
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_readdir");
+    dirent_t entries[DIRENTS_PER_BLOCK];
+    int dir = ROOT_DIR;
+    int loaded = -1;
 
-    // get the inode index
-    int index = file_descriptors[fileID].inode;
+    if (cookie == NULL || fname == NULL || *cookie < 0)
+        return -1;
 
-    // check for invalid size
-    if (loc > inode_table[index].size)
+    // resolve the directory itself, "/" and "" are the root
+    if (path != NULL && path[strspn(path, "/")] != '\0')
     {
-        printf("ERROR (fwseek): loc > inode_table[index].size\n");
-        return -1;
+        char leaf[MAX_NAME_LEN + 1];
+        if (resolve_path(path, &dir, leaf) < 0)
+            return -1;
+        dir = dir_find(dir, leaf, NULL, NULL);
+        if (dir < 0 || !(inode_flags[load_inode(dir)] & INODE_DIR))
+        {
+            printf("ERROR (ssfs_readdir): %s is not a directory.\n", path);
+            return -1;
+        }
     }
 
-    file_descriptors[fileID].write_pointer = loc;
+    for (; *cookie < dir_num_blocks(dir) * DIRENTS_PER_BLOCK; (*cookie)++)
+    {
+        if (*cookie / DIRENTS_PER_BLOCK != loaded)
+        {
+            loaded = *cookie / DIRENTS_PER_BLOCK;
+            if (read_dir_block(dir, loaded, entries) < 0)
+                return -1;
+        }
+        if (entries[*cookie % DIRENTS_PER_BLOCK].inode >= 0)
+        {
+            if (read_name(&entries[*cookie % DIRENTS_PER_BLOCK], fname) < 0)
+                return -1;
+            (*cookie)++;
+            return 1;
+        }
+    }
     return 0;
 }
 
-// reads length bytes from fileID into buf
-// returns number of bytes read
-int ssfs_fread(int fileID, char *buf, int length)
+// maps the contents of fileID into memory, blocks are read straight into the
+// mapping without a bounce buffer. the mapping is private to the descriptor:
+// later ssfs_fwrite calls are not reflected in it, and changes made through a
+// writable mapping reach the disk only for blocks flagged with ssfs_mdirty
+char *ssfs_mmap(int fileID, int flags)
 {
-    int remaining = length;
-    int read_amount = 0;
-    int buf_pointer = 0;
-    int copy_amount;
-    void *buffer = malloc(BLOCK_SIZE);
-    int inode_index = file_descriptors[fileID].inode;
-    int location = file_descriptors[fileID].read_pointer % BLOCK_SIZE;
-    int block_index;
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_mmap");
+    file_descriptor_t *fd;
+    int size;
 
-    // check for invalid length or fileID
-    if (length < 0 || fileID < 0 || fileID >= NUM_FILES)
+    if (get_fd_inode(fileID) == -1)
     {
-        free(buffer);
-        return -1;
+        printf("ERROR (ssfs_mmap): invalid fileID.\n");
+        return NULL;
     }
-    else if (length == 0)
+    if ((flags & SSFS_MAP_READ) == 0 && (flags & SSFS_MAP_WRITE) == 0)
     {
-        free(buffer);
-        return 0;
+        printf("ERROR (ssfs_mmap): invalid flags.\n");
+        return NULL;
     }
+    if ((flags & SSFS_MAP_WRITE) && check_writable("ssfs_mmap") < 0)
+        return NULL;
 
-    // check for a closed file
-    if (inode_index == -1)
+    fd = &file_descriptors[fileID];
+    if (fd->map != NULL)
     {
-        printf("ERROR: (ssfs_read): fd entry was unitialized.\n");
-        free(buffer);
-        return read_amount;
+        if ((flags & SSFS_MAP_WRITE) && !(fd->map_flags & SSFS_MAP_WRITE))
+        {
+            printf("ERROR (ssfs_mmap): file is already mapped read-only.\n");
+            return NULL;
+        }
+        return fd->map;
     }
 
-    // check for empty inode
-    if (inode_table[inode_index].size == 0)
+    // writable mappings are written back a block at a time, so an inline file or a packed tail moves to blocks
+    if ((flags & SSFS_MAP_WRITE) && (inode_flags[load_inode(fd->inode)] & INODE_COMPRESSED))
     {
-        // printf("opened file's inode lead to empty inode...\n");
-        // printf("file_descriptors[fileID].inode = %i\n", file_descriptors[fileID].inode);
-        free(buffer);
-        return read_amount;
+        printf("ERROR (ssfs_mmap): compressed files can only be mapped for reading.\n");
+        return NULL;
+    }
+    if (flags & SSFS_MAP_WRITE)
+    {
+        int promoted = promote_inline(fd->inode);
+        if (promoted == 0)
+            promoted = unpack_tail(fd->inode);
+        if (promoted < 0)
+            return NULL;
+        if (promoted)
+        {
+            write_free_bitmap();
+            write_inode_table();
+        }
     }
 
-    // initialize buffers
-    memset(buffer, 0, BLOCK_SIZE);
-    memset(buf, 0, length);
+    size = inode_sizes[load_inode(fd->inode)];
+    fd->map_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-    // read a block from the disk
-    block_index = get_block(inode_table[inode_index], file_descriptors[fileID].read_pointer);
-    if (block_index == -1)
+    // never hand out a NULL mapping for an empty file
+    fd->map = malloc(fd->map_blocks > 0 ? fd->map_blocks * BLOCK_SIZE : 1);
+    if (fd->map == NULL)
     {
-        printf("ERROR (ssfs_read): inode's pointer was unitialized.\n");
-        free(buffer);
-        return read_amount;
+        printf("ERROR (ssfs_mmap): could not allocate memory for mapping.\n");
+        fd->map_blocks = 0;
+        return NULL;
+    }
+    if (flags & SSFS_MAP_WRITE)
+    {
+        fd->map_dirty = calloc(fd->map_blocks / 32 + 1, sizeof(uint32_t));
+        if (fd->map_dirty == NULL)
+        {
+            printf("ERROR (ssfs_mmap): could not allocate memory for dirty map.\n");
+            release_mapping(fileID, 0);
+            return NULL;
+        }
     }
-    read_blocks(block_index, 1, buffer);
+    fd->map_flags = flags;
 
-    // copy to buf
-    if (remaining > BLOCK_SIZE - location)
-        copy_amount = BLOCK_SIZE - location;
-    else if (remaining > strlen(buf) - 1)
-        copy_amount = strlen(buf) - 1;
-    else
-        copy_amount = remaining;
+    if (inode_flags[fd->inode] & INODE_INLINE)
+        memcpy(fd->map, get_inode_map(fd->inode)->data, size);
+    else if (inode_flags[fd->inode] & INODE_COMPRESSED)
+    {
+        if (read_compressed(fd->inode, 0, fd->map, size) < 0)
+        {
+            release_mapping(fileID, 0);
+            return NULL;
+        }
+    }
+    else if (transfer_file_blocks(fd->inode, 0, fd->map_blocks, fd->map, 0) < 0)
+    {
+        release_mapping(fileID, 0);
+        return NULL;
+    }
 
-    // debug
-    // printf("fread(): fileID = %i\n", fileID);
-    // printf("fread(): inode_index = %i\n", inode_index);
-    // printf("fread(): location = %i\n", location);
-    // printf("fread(): strlen(buf) = %zu\n", strlen(buf));
-    // printf("fread(): length = %i\n", length);
-    // printf("fread(): copy_amount = %i\n\n", copy_amount);
+    // the tail of the last block is not part of the file
+    if (size % BLOCK_SIZE != 0)
+        memset(fd->map + size, 0, BLOCK_SIZE - size % BLOCK_SIZE);
 
-    memcpy(buf + buf_pointer, buffer + location, copy_amount);
+    return fd->map;
+}
 
-    // update buf pointer, read pointer, remaining amount to read, and location
-    buf_pointer += copy_amount;
-    file_descriptors[fileID].read_pointer += copy_amount;
-    if (file_descriptors[fileID].read_pointer >= inode_table[inode_index].size)
-        file_descriptors[fileID].read_pointer = 0;
-    remaining -= copy_amount;
-    read_amount += copy_amount;
+// marks a byte range of a writable mapping as modified
+int ssfs_mdirty(int fileID, int offset, int length)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_mdirty");
+    file_descriptor_t *fd;
 
-    // check to see if we've filled up the buffer
-    if (copy_amount == length)
+    if (get_fd_inode(fileID) == -1 || file_descriptors[fileID].map == NULL)
     {
-        free(buffer);
-        printf("fread(): returning %i", copy_amount);
-        return copy_amount;
+        printf("ERROR (ssfs_mdirty): file is not mapped.\n");
+        return -1;
     }
 
-    while (remaining > 0)
+    fd = &file_descriptors[fileID];
+    if (!(fd->map_flags & SSFS_MAP_WRITE))
+    {
+        printf("ERROR (ssfs_mdirty): mapping is read-only.\n");
+        return -1;
+    }
+    if (offset < 0 || length < 0 || offset + length > inode_sizes[load_inode(fd->inode)])
     {
-        // clear the buffer
-        memset(buffer, 0, BLOCK_SIZE);
+        printf("ERROR (ssfs_mdirty): range is outside of the file.\n");
+        return -1;
+    }
 
-        // read a block from the disk
-        block_index = get_block(inode_table[inode_index], file_descriptors[fileID].read_pointer);
-        if (block_index == -1)
-        {
-            printf("ERROR (ssfs_read): inode's pointer was unitialized.\n");
-            free(buffer);
-            return read_amount;
-        }
-        read_blocks(block_index, 1, buffer);
+    for (int i = offset / BLOCK_SIZE; i * BLOCK_SIZE < offset + length; i++)
+        set_bit(fd->map_dirty, i);
 
-        // copy the read block to buf
-        if (remaining > BLOCK_SIZE)
-            copy_amount = BLOCK_SIZE;
-        else
-            copy_amount = remaining;
-        memcpy(buf + buf_pointer, buffer, copy_amount);
-
-        // increment values
-        buf_pointer += copy_amount;
-        file_descriptors[fileID].read_pointer += copy_amount;
-        if (file_descriptors[fileID].read_pointer >= inode_table[inode_index].size)
-            file_descriptors[fileID].read_pointer = 0;
-        remaining -= copy_amount;
-        read_amount += copy_amount;
+    return 0;
+}
+
+// writes back the dirty blocks of a mapping and releases it
+int ssfs_munmap(int fileID)
+{
+    FS_LOCKED();
+    TRACE_SCOPE("ssfs_munmap");
+    if (get_fd_inode(fileID) == -1 || file_descriptors[fileID].map == NULL)
+    {
+        printf("ERROR (ssfs_munmap): file is not mapped.\n");
+        return -1;
     }
 
-    free(buffer);
-    return read_amount;
+    return release_mapping(fileID, 1);
 }
 
-// writes length bytes to fileID from buf
-// returns number of bytes written
-int ssfs_fwrite(int fileID, char *buf, int length)
+// reads or writes at sqe->offset like pread/pwrite, the descriptor's pointers are put
+// back afterwards so queued I/O never depends on them. runs under fs_lock
+int execute_at_offset(ssfs_sqe_t *sqe)
 {
+    int ret;
 
-    int remaining = length;
-    int buf_pointer = 0;
-    int copy_amount = 0;
-    int ind_inode_index;
-    int location = file_descriptors[fileID].write_pointer % BLOCK_SIZE;
-    int pointer_index = file_descriptors[fileID].write_pointer / BLOCK_SIZE;
-    int direct_inode_index = file_descriptors[fileID].inode;
-    int inode_index = direct_inode_index;
-    int block_index = get_block(inode_table[direct_inode_index], file_descriptors[fileID].write_pointer);
-    // create a buffer
-    void *buffer = malloc(BLOCK_SIZE);
-    memset(buffer, 0, BLOCK_SIZE);
-
-    // check for invalid length or fileID
-    if (length < 0 || fileID < 0 || fileID >= NUM_FILES)
+    if (get_fd_inode(sqe->fileID) == -1)
     {
-        free(buffer);
+        printf("ERROR (execute_sqe): invalid fileID\n");
         return -1;
     }
-    else if (length == 0)
+    if (sqe->offset < 0)
     {
-        free(buffer);
-        return 0;
+        printf("ERROR (execute_sqe): offset < 0\n");
+        return -1;
     }
 
-    if (buffer == NULL)
+    int read_pointer = file_descriptors[sqe->fileID].read_pointer;
+    int write_pointer = file_descriptors[sqe->fileID].write_pointer;
+    if (sqe->op == SSFS_OP_FREAD)
     {
-        printf("Error (ssfs_fwrite): Could not allocate memory for buffer.\n");
-        free(buffer);
-        return -1;
+        file_descriptors[sqe->fileID].read_pointer = sqe->offset;
+        ret = ssfs_fread(sqe->fileID, sqe->buf, sqe->length);
+    }
+    else
+    {
+        file_descriptors[sqe->fileID].write_pointer = sqe->offset;
+        ret = ssfs_fwrite(sqe->fileID, sqe->buf, sqe->length);
     }
+    file_descriptors[sqe->fileID].read_pointer = read_pointer;
+    file_descriptors[sqe->fileID].write_pointer = write_pointer;
+    return ret;
+}
 
-    // check to see if the block pointed by the write pointer is already initialized
-    if (block_index != -1)
+// executes a single submission entry against the file system
+int execute_sqe(ssfs_sqe_t *sqe)
+{
+    switch (sqe->op)
     {
-        read_blocks(inode_table[inode_index].pointers[pointer_index], 1, buffer);
+    case SSFS_OP_FOPEN:
+        return ssfs_fopen(sqe->name);
+    case SSFS_OP_FREAD:
+    case SSFS_OP_FWRITE:
+        return execute_at_offset(sqe);
+    case SSFS_OP_REMOVE:
+        return ssfs_remove(sqe->name);
+    default:
+        printf("ERROR (execute_sqe): unknown operation %i.\n", sqe->op);
+        return -1;
+    }
+}
 
-        // get the amount of data to copy
-        if (remaining > BLOCK_SIZE - location)
-            copy_amount = BLOCK_SIZE - location;
-        else
-            copy_amount = remaining;
+// worker loop, pops submissions and pushes their completions
+void *async_worker(void *arg)
+{
+    ssfs_sqe_t sqe;
+    ssfs_cqe_t cqe;
 
-        // write to disk
-        memcpy(buffer + location, buf + buf_pointer, copy_amount);
-        write_blocks(inode_table[inode_index].pointers[pointer_index], 1, buffer);
+    pthread_mutex_lock(&async_lock);
+    while (1)
+    {
+        while (sq_head == sq_tail && !async_stopping)
+            pthread_cond_wait(&async_submitted, &async_lock);
+        if (sq_head == sq_tail && async_stopping)
+            break;
 
-        // update values
-        buf_pointer = buf_pointer + copy_amount;
-        remaining = remaining - copy_amount;
-        file_descriptors[fileID].write_pointer = file_descriptors[fileID].write_pointer + copy_amount;
-        inode_table[direct_inode_index].size += copy_amount;
-        write_inode_table();
+        sqe = submission_ring[sq_head % async_depth];
+        sq_head++;
+        pthread_mutex_unlock(&async_lock);
 
-        // update the pointer index
-        if (pointer_index < NUM_POINTERS - 1)
-        {
-            pointer_index++;
-            ind_inode_index = -1;
-        }
-        else
-        {
-            // create an indirect pointer
-            ind_inode_index = get_unused_inode();
-            if (ind_inode_index < 0)
-            {
-                printf("Could not find an empty inode for new indirect pointer.\n");
-                free(buffer);
-                return -1;
-            }
-            inode_table[inode_index].ind_pointer = ind_inode_index;
-            inode_index = ind_inode_index;
-            inode_table[inode_index].size = 0;
-            pointer_index = 0;
-            write_inode_table();
-        }
+        lock_fs();
+        cqe.result = execute_sqe(&sqe);
+        pthread_mutex_unlock(&fs_lock);
+        cqe.op = sqe.op;
+        cqe.user_data = sqe.user_data;
+
+        // the completion ring cannot overflow since in flight entries are capped at async_depth
+        pthread_mutex_lock(&async_lock);
+        completion_ring[cq_tail % async_depth] = cqe;
+        cq_tail++;
+        pthread_cond_broadcast(&async_completed);
     }
+    pthread_mutex_unlock(&async_lock);
+    return NULL;
+}
 
-    // if there is still data remianing to be stored
-    while (remaining > 0)
+// starts the worker pool, queue_depth bounds the number of operations in flight
+int ssfs_async_init(int queue_depth, int num_workers)
+{
+    TRACE_SCOPE("ssfs_async_init");
+    if (submission_ring != NULL)
     {
-        // clear the buffer
-        memset(buffer, 0, BLOCK_SIZE);
-
-        // get the amount to copy
-        if (remaining > BLOCK_SIZE)
-            copy_amount = BLOCK_SIZE;
-        else
-            copy_amount = remaining;
+        printf("ERROR (ssfs_async_init): async queue already initialized.\n");
+        return -1;
+    }
+    if (queue_depth <= 0 || queue_depth > ASYNC_MAX_DEPTH || num_workers <= 0 || num_workers > ASYNC_MAX_WORKERS)
+    {
+        printf("ERROR (ssfs_async_init): invalid queue depth or worker count.\n");
+        return -1;
+    }
 
-        // copy the appropriate amount to the buffer
-        memcpy(buffer, buf + buf_pointer, copy_amount);
-        remaining = remaining - copy_amount;
-        buf_pointer = buf_pointer + copy_amount;
+    submission_ring = malloc(queue_depth * sizeof(ssfs_sqe_t));
+    completion_ring = malloc(queue_depth * sizeof(ssfs_cqe_t));
+    if (submission_ring == NULL || completion_ring == NULL)
+    {
+        printf("ERROR (ssfs_async_init): could not allocate memory for rings.\n");
+        free(submission_ring);
+        free(completion_ring);
+        submission_ring = NULL;
+        completion_ring = NULL;
+        return -1;
+    }
 
-        // update the block index
-        inode_index = get_file_inode_index(direct_inode_index, file_descriptors[fileID].write_pointer);
-        block_index = get_block(inode_table[direct_inode_index], file_descriptors[fileID].write_pointer);
-        if (block_index == -1)
+    async_depth = queue_depth;
+    sq_head = sq_tail = cq_head = cq_tail = 0;
+    async_in_flight = 0;
+    async_stopping = 0;
+    for (async_num_workers = 0; async_num_workers < num_workers; async_num_workers++)
+    {
+        if (pthread_create(&async_workers[async_num_workers], NULL, async_worker, NULL) != 0)
         {
-            block_index = get_unused_block();
-            if (block_index == -1)
-            {
-                printf("Could not find an empty block.\n");
-                free(buffer);
-                return -1;
-            }
-            set_bit(free_bitmap.bits, block_index);
-            inode_table[inode_index].pointers[pointer_index] = block_index;
-            write_inode_table();
-            write_free_bitmap();
+            printf("ERROR (ssfs_async_init): could not start worker #%i.\n", async_num_workers);
+            ssfs_async_shutdown();
+            return -1;
         }
+    }
+    return 0;
+}
 
-        // write to that block
-        write_blocks(block_index, 1, buffer);
-
-        // update buf pointer, remaining amount to copy, write pointer, inode size
-        buf_pointer = buf_pointer + copy_amount;
-        remaining = remaining - copy_amount;
-        file_descriptors[fileID].write_pointer = file_descriptors[fileID].write_pointer + copy_amount;
-        inode_table[direct_inode_index].size += copy_amount;
-        write_inode_table();
+// queues an operation, returns -1 when the ring is full or not initialized
+int ssfs_async_submit(ssfs_sqe_t *sqe)
+{
+    TRACE_SCOPE("ssfs_async_submit");
+    if (sqe == NULL)
+        return -1;
 
-        if (pointer_index < NUM_POINTERS - 1)
-        {
-            pointer_index++;
-            ind_inode_index = -1;
-        }
-        else
-        {
-            // create an indirect pointer
-            ind_inode_index = get_unused_inode();
-            if (ind_inode_index < 0)
-            {
-                printf("Could not find an empty inode for new indirect pointer.\n");
-                free(buffer);
-                return -1;
-            }
-            inode_table[inode_index].ind_pointer = ind_inode_index;
-            inode_table[ind_inode_index].size = 0;
-            pointer_index = 0;
-            write_inode_table();
-        }
+    pthread_mutex_lock(&async_lock);
+    if (submission_ring == NULL || async_stopping)
+    {
+        pthread_mutex_unlock(&async_lock);
+        printf("ERROR (ssfs_async_submit): async queue is not running.\n");
+        return -1;
+    }
+    if (async_in_flight == async_depth)
+    {
+        pthread_mutex_unlock(&async_lock);
+        return -1;
     }
 
-    // free memory and return
-    free(buffer);
-    return length;
+    submission_ring[sq_tail % async_depth] = *sqe;
+    sq_tail++;
+    async_in_flight++;
+    pthread_cond_signal(&async_submitted);
+    pthread_mutex_unlock(&async_lock);
+    return 0;
 }
 
-int ssfs_remove(char *file)
+// copies up to max completions into cqes, waiting until at least min_complete
+// are available or nothing is left in flight, returns the number reaped
+int ssfs_async_reap(ssfs_cqe_t *cqes, int max, int min_complete)
 {
+    TRACE_SCOPE("ssfs_async_reap");
+    int reaped = 0;
 
-    // printf("remove(): file name (argument) = %s\n", file);
+    if (cqes == NULL || max <= 0)
+        return -1;
+    if (min_complete > max)
+        min_complete = max;
 
-    // check length of argument
-    int len = strlen(file);
-    if (len > MAX_FILENAME - 1)
-        len = MAX_FILENAME - 1;
+    pthread_mutex_lock(&async_lock);
+    if (completion_ring == NULL)
+    {
+        pthread_mutex_unlock(&async_lock);
+        return -1;
+    }
+    while (cq_tail - cq_head < min_complete && cq_tail - cq_head < async_in_flight)
+        pthread_cond_wait(&async_completed, &async_lock);
 
-    // go through all files in root directory
-    for (int i = 0; i < NUM_FILES; i++)
+    while (reaped < max && cq_head != cq_tail)
     {
-        // check for empty slot
-        if (super_block.root[i].inode != -1)
-        {
-            // printf("remove(): super_block.root[i].name = %s\n", super_block.root[i].name);
+        cqes[reaped++] = completion_ring[cq_head % async_depth];
+        cq_head++;
+        async_in_flight--;
+    }
+    pthread_mutex_unlock(&async_lock);
+    return reaped;
+}
 
-            // compare name of file in directory to argument
-            if (strncmp(super_block.root[i].name, file, len) == 0)
-            {
-                // printf("remove(): closing file #%i...\n", i);
+// drains the submission ring, stops the workers and releases the rings
+void ssfs_async_shutdown()
+{
+    TRACE_SCOPE("ssfs_async_shutdown");
+    pthread_mutex_lock(&async_lock);
+    async_stopping = 1;
+    pthread_cond_broadcast(&async_submitted);
+    pthread_mutex_unlock(&async_lock);
 
-                // reset the inodes and directory entry
-                reset_file_inodes(inode_table[super_block.root[i].inode]);
-                super_block.root[i].inode = -1;
-                memset(super_block.root[i].name, 0, MAX_FILENAME);
+    for (int i = 0; i < async_num_workers; i++)
+        pthread_join(async_workers[i], NULL);
 
-                // reset the file descriptor
-                for (int j = 0; j < MAX_FD_ENTRY; j++)
-                {
-                    // check for empty slot
-                    if (file_descriptors[j].inode != -1)
-                    {
-                        // check if arugments matches file descriptor name
-                        if (strncmp(file_descriptors[j].name, file, len) == 0)
-                        {
-                            memset(file_descriptors[j].name, 0, MAX_FILENAME);
-                            file_descriptors[j].inode = -1;
-                            file_descriptors[j].write_pointer = 0;
-                            file_descriptors[j].read_pointer = 0;
-                        }
-                    }
-                }
-                write_super_block();
-                return 0;
-            }
-        }
-    }
-    printf("ERROR (remove): couldn't find file %s\n", file);
-    return -1;
+    pthread_mutex_lock(&async_lock);
+    free(submission_ring);
+    free(completion_ring);
+    submission_ring = NULL;
+    completion_ring = NULL;
+    async_num_workers = 0;
+    async_in_flight = 0;
+    pthread_mutex_unlock(&async_lock);
 }
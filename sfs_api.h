@@ -8,21 +8,66 @@
 
 #define NAME "260639146.ssfs"
 #define BLOCK_SIZE 1024
-#define MAGIC_NUM 0xABCD0005
-#define MAX_FILENAME 11 // extra space for null character
-#define MAX_FD_ENTRY 32
+#define MAGIC_NUM 0xABCD000E
+#define SSFS_MOUNT_LAZY 2 // mkssfs mode reading metadata on demand
+#define MAX_NAME_LEN 255 // longest file name, without the null character
+#define NAME_HEAP_HEADER 8 // tail and live byte counts at the start of every name heap block
+#define MAX_FD_ENTRY 65536 // hard cap, the table grows on demand
+#define FD_TABLE_INITIAL 32
 #define NUM_BLOCKS 1026
 #define NUM_DATA_BLOCKS 1024
-#define NUM_POINTERS 14
+#define NUM_POINTERS 13
 #define NUM_INODES 63
-#define NUM_INODE_BLOCKS 4
-#define NUM_FILES 63
+#define INODE_SIZE 256 // on-disk inode, the block map area doubles as inline data
+#define INLINE_MAX_SIZE (INODE_SIZE - 3 * (int)sizeof(int)) // largest file kept inside its inode
+#define NUM_INODE_BLOCKS ((NUM_INODES * INODE_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE)
+#define INODES_PER_BLOCK ((int)(BLOCK_SIZE / sizeof(inode_t)))
+#define INODE_BITMAP_WORDS ((NUM_INODES + 31) / 32)
+#define ROOT_DIR_BLOCKS (NUM_BLOCKS / 256) // dirent region of the root directory, scales with the volume
+#define ROOT_DIR_START (1 + NUM_INODE_BLOCKS)
+#define SHARES_BLOCK (ROOT_DIR_START + ROOT_DIR_BLOCKS) // per block count of extra owners, see ssfs_clone
+#define MAX_BLOCK_SHARES 255
+#define MAX_SNAPSHOTS 4
+#define SNAPSHOT_BLOCKS (1 + NUM_INODE_BLOCKS + ROOT_DIR_BLOCKS) // frozen super block, inode table and root directory
+#define DEDUP_START (SHARES_BLOCK + 1) // fingerprint of every data block, see ssfs_set_dedup
+#define HASHES_PER_BLOCK ((int)(BLOCK_SIZE / sizeof(uint32_t)))
+#define DEDUP_BLOCKS (NUM_DATA_BLOCKS / HASHES_PER_BLOCK)
+#define DEDUP_BUCKETS 256 // chains of blocks by fingerprint, in memory only
+#define FIRST_DATA_BLOCK (DEDUP_START + DEDUP_BLOCKS)
+#define NUM_FILES (ROOT_DIR_BLOCKS * DIRENTS_PER_BLOCK)
+#define ROOT_DIR -2 // directory handle of the root dirent region
+#define DIRENTS_PER_BLOCK ((int)(BLOCK_SIZE / sizeof(dirent_t)))
+#define DIRENT_EMPTY -1   // never used slot, lookups stop at a block holding one
+#define DIRENT_DELETED -2 // removed entry in a block that had no empty slot
+#define ALLOC_WINDOW 8 // blocks reserved ahead of the writes through a descriptor
+#define DIR_PROBE_LIMIT 2 // blocks probed by an insert before the directory doubles
+#define WRITE_DATA 0 // disk_write of file contents
+#define WRITE_METADATA 1 // disk_write of anything else, counted apart by ssfs_statfs
+#define INODE_DIR 0x1
+#define INODE_HEAP 0x2 // hidden file holding the names of every directory entry
+#define INODE_INLINE 0x4 // file bytes are stored in the inode instead of blocks
+#define INODE_TAIL 0x8 // last partial block is a fragment of a block shared with other tails
+#define TAIL_MAX_SIZE (BLOCK_SIZE / 2) // longest partial block worth packing
+#define INODE_COMPRESSED 0x10 // data is stored in clusters compressed one at a time
+#define CLUSTER_BLOCKS 16 // file blocks compressed together, the unit of random access
+#define CLUSTER_SIZE (CLUSTER_BLOCKS * BLOCK_SIZE)
+#define ASYNC_MAX_DEPTH 4096
+#define ASYNC_MAX_WORKERS 16
+#define SSFS_MAP_READ 0x1
+#define SSFS_MAP_WRITE 0x2
+#define SSFS_SEEK_DATA 1
+#define SSFS_SEEK_HOLE 2
+#define SSFS_LATENCY_BUCKETS 24 // bucket i counts calls under 2^i microseconds not in a lower one, the last any slower
 
+// names live in the name heap, the entry keeps their hash and length so
+// lookups only read the name bytes of an entry whose hash matches
 typedef struct
 {
-    char name[MAX_FILENAME];
+    uint32_t hash;
     int inode;
-} file_t;
+    int name_offset; // heap block * BLOCK_SIZE + offset in the block
+    int name_len;
+} dirent_t;
 
 typedef struct
 {
@@ -30,22 +75,45 @@ typedef struct
     int block_size;
     int num_blocks;
     int num_inodes;
-    file_t root[NUM_FILES];
+    int inode_start;
+    int root_start;
+    int root_blocks;
+    int name_heap; // inode of the name heap
+    int snapshots[MAX_SNAPSHOTS]; // first block of each snapshot, -1 for an unused slot
+    int dedup; // blocks written by ssfs_fwrite are shared with identical ones
 } super_block_t;
 
+// an entry of the fd table. the table is shared by every thread, descriptors are
+// not per thread, and is only read or changed by the entry points under fs_lock
 typedef struct
 {
-    char name[MAX_FILENAME];
     int inode;
     int write_pointer;
     int read_pointer;
+    char *map;           // block aligned image of the file while mapped, NULL otherwise
+    int map_flags;
+    int map_blocks;
+    uint32_t *map_dirty; // one bit per mapped block, only for writable mappings
+    int next_free;       // next entry of the free list while unused
+    int window_start;    // blocks [window_start, window_end) are reserved for writes through
+    int window_end;      // this descriptor, -1 without a window
 } file_descriptor_t;
 
 typedef struct
 {
     int size;
     int ind_pointer;
-    int pointers[NUM_POINTERS];
+    int flags;
+    union
+    {
+        struct
+        {
+            int pointers[NUM_POINTERS];
+            int tail_block;  // with INODE_TAIL, block holding the last partial block
+            int tail_offset; // where it starts in tail_block, it is size % BLOCK_SIZE long
+        };
+        char data[INLINE_MAX_SIZE]; // with INODE_INLINE
+    };
 } inode_t;
 
 typedef struct
@@ -53,6 +121,83 @@ typedef struct
     uint32_t bits[BLOCK_SIZE / sizeof(uint32_t)];
 } bitmap_t;
 
+// outcome of ssfs_defrag, scores as returned by ssfs_frag_score
+typedef struct
+{
+    int score_before;
+    int score_after;
+    int files_moved;
+    int blocks_moved;
+} ssfs_defrag_stats_t;
+
+// operations measured by ssfs_statfs, indexes ssfs_statfs_t.ops
+typedef enum
+{
+    SSFS_STAT_FOPEN,
+    SSFS_STAT_FREAD,
+    SSFS_STAT_FWRITE,
+    SSFS_STAT_REMOVE,
+    SSFS_STAT_FRSEEK,
+    SSFS_STAT_FWSEEK,
+    SSFS_STAT_NUM_OPS
+} ssfs_stat_op_t;
+
+// counters of one operation since the program started. blocks are counted as they
+// are transferred, metadata writes are the blocks written that are not file contents,
+// including the directory, name heap and snapshot blocks kept in the data region
+typedef struct
+{
+    uint64_t calls;
+    uint64_t errors; // calls returning -1
+    uint64_t bytes;
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t metadata_writes;
+    uint64_t latency[SSFS_LATENCY_BUCKETS];
+} ssfs_op_stats_t;
+
+// state of the mounted volume as returned by ssfs_statfs, block counts are of the data region
+typedef struct
+{
+    int total_blocks;
+    int free_blocks;
+    int total_inodes;
+    int free_inodes;
+    int frag_score; // as returned by ssfs_frag_score
+    int open_files; // descriptors in use
+    ssfs_op_stats_t ops[SSFS_STAT_NUM_OPS];
+} ssfs_statfs_t;
+
+typedef enum
+{
+    SSFS_OP_FOPEN,
+    SSFS_OP_FREAD,
+    SSFS_OP_FWRITE,
+    SSFS_OP_REMOVE
+} ssfs_op_t;
+
+// submission entry, name/buf must stay valid until the completion is reaped.
+// FREAD and FWRITE transfer at offset like pread/pwrite and leave the descriptor's
+// pointers alone, so entries in flight on one descriptor do not depend on each other
+typedef struct
+{
+    ssfs_op_t op;
+    int fileID;
+    char *name;
+    char *buf;
+    int length;
+    int offset;
+    void *user_data;
+} ssfs_sqe_t;
+
+// completion entry, result is what the synchronous call would have returned
+typedef struct
+{
+    ssfs_op_t op;
+    int result;
+    void *user_data;
+} ssfs_cqe_t;
+
 void mkssfs(int fresh);
 int ssfs_get_next_file_name(char *fname);
 int ssfs_get_file_size(char *path);
@@ -60,6 +205,35 @@ int ssfs_fopen(char *name);
 int ssfs_fclose(int fileID);
 int ssfs_frseek(int fileID, int loc);
 int ssfs_fwseek(int fileID, int loc);
+int ssfs_flseek(int fileID, int loc, int whence);
 int ssfs_fwrite(int fileID, char *buf, int length);
 int ssfs_fread(int fileID, char *buf, int length);
 int ssfs_remove(char *file);
+int ssfs_clone(char *src, char *dst);
+int ssfs_snapshot();
+int ssfs_snapshot_delete(int snapshot);
+int ssfs_set_dedup(int enabled);
+int ssfs_frag_score();
+int ssfs_defrag(int max_blocks, ssfs_defrag_stats_t *stats);
+int ssfs_statfs(ssfs_statfs_t *stats);
+int ssfs_stats_export(char *path, int interval_ms);
+void ssfs_trace(int enabled);
+int ssfs_trace_dump(char *path);
+int mkssfs_snapshot(int snapshot);
+int ssfs_remove_batch(char **files, int count, int *results);
+int ssfs_remove_prefix(char *prefix);
+int ssfs_mkdir(char *path);
+int ssfs_rmdir(char *path);
+int ssfs_readdir(char *path, int *cookie, char *fname);
+int ssfs_fallocate(int fileID, int offset, int length);
+int ssfs_ftruncate(int fileID, int size);
+int ssfs_fcompress(int fileID);
+char *ssfs_mmap(int fileID, int flags);
+int ssfs_mdirty(int fileID, int offset, int length);
+int ssfs_munmap(int fileID);
+// every call above and every queued entry runs under one lock, so synchronous calls
+// may be made from any thread while the async workers are running
+int ssfs_async_init(int queue_depth, int num_workers);
+int ssfs_async_submit(ssfs_sqe_t *sqe);
+int ssfs_async_reap(ssfs_cqe_t *cqes, int max, int min_complete);
+void ssfs_async_shutdown();
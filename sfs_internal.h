@@ -0,0 +1,75 @@
+// declarations shared by the library and the tools built with it, not part of the api.
+// included after sfs_api.h
+
+#define TRACE_RING_EVENTS 65536 // events kept per thread, the oldest are overwritten
+
+// block map of an inode, the cold part of the in-memory inode cache
+typedef struct
+{
+    int ind_pointer;
+    union
+    {
+        struct
+        {
+            int pointers[NUM_POINTERS];
+            int tail_block;  // with INODE_TAIL, block holding the last partial block
+            int tail_offset; // where it starts in tail_block, it is size % BLOCK_SIZE long
+        };
+        char data[INLINE_MAX_SIZE]; // with INODE_INLINE
+    };
+} inode_map_t;
+
+// bit array helpers and the directory entry name hash, also used by ssfs_fsck
+void set_bit(uint32_t arr[], int k);
+void clear_bit(uint32_t arr[], int k);
+int test_bit(uint32_t arr[], int k);
+uint32_t hash_name(char *name, int len);
+
+// disk counters and clock at the start of a measured operation
+typedef struct
+{
+    uint64_t start_us;
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t metadata_writes;
+} op_start_t;
+
+// one trace event, phase is 'B' or 'E' as in the Chrome trace format. block I/O
+// events carry the first block and the number of blocks, the others nblocks 0
+typedef struct
+{
+    uint64_t ts_ns;
+    const char *name;
+    int block;
+    int nblocks;
+    char phase;
+} trace_event_t;
+
+// ring of the last TRACE_RING_EVENTS events of a thread, only that thread writes it.
+// head counts every event recorded and is published once the event is filled in
+typedef struct trace_ring
+{
+    trace_event_t *events;
+    uint64_t head;
+    int tid;
+    struct trace_ring *next;
+} trace_ring_t;
+
+// trace probes, off unless ssfs_trace or SSFS_TRACE turned tracing on. a disabled probe
+// is one test of trace_enabled, building with -DSSFS_NO_TRACE removes them altogether.
+// TRACE_SCOPE records the end of the enclosing function on every return path
+#ifndef SSFS_NO_TRACE
+#define TRACE_SCOPE(name) const char *trace_scope __attribute__((cleanup(trace_scope_end))) = __builtin_expect(trace_enabled, 0) ? trace_scope_begin(name) : NULL
+#define TRACE_BEGIN(name, block, nblocks) do { if (__builtin_expect(trace_enabled, 0)) trace_event(name, 'B', block, nblocks); } while (0)
+#define TRACE_END(name) do { if (__builtin_expect(trace_enabled, 0)) trace_event(name, 'E', -1, 0); } while (0)
+#else
+#define TRACE_SCOPE(name) do { } while (0)
+#define TRACE_BEGIN(name, block, nblocks) do { } while (0)
+#define TRACE_END(name) do { } while (0)
+#endif
+
+// defined in sfs_api.c, used by the trace probes
+extern int trace_enabled;
+void trace_event(const char *name, char phase, int block, int nblocks);
+const char *trace_scope_begin(const char *name);
+void trace_scope_end(const char **scope);
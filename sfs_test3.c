@@ -0,0 +1,46 @@
+#include "tests.h"
+/*
+   Feature tests for the calls beyond the assignment. Each test starts from a fresh
+   volume, checks what the calls return and what reads back, and runs ssfs_fsck over
+   the image it leaves. For all tests, -1 is considered error and 0 is considered success.
+ */
+int feature_test(){
+    int err_no = 0;
+    printf("\n-------------------------------\nInitializing Feature test.\n--------------------------------\n\n");
+
+    test_async(&err_no);
+    test_mmap(&err_no);
+    test_fallocate(&err_no);
+    test_ftruncate(&err_no);
+    test_remove_batch(&err_no);
+    test_fd_table(&err_no);
+    test_inode_alloc(&err_no);
+    test_directories(&err_no);
+    test_root_dir(&err_no);
+    test_long_names(&err_no);
+    test_lazy_mount(&err_no);
+    test_inode_cache(&err_no);
+    test_fsck_repair(&err_no);
+    test_clone(&err_no);
+    test_snapshot(&err_no);
+    test_inline(&err_no);
+    test_tails(&err_no);
+    test_compress(&err_no);
+    test_dedup(&err_no);
+    test_dedup_clone(&err_no);
+    test_defrag(&err_no);
+    test_alloc_windows(&err_no);
+    test_sparse(&err_no);
+    test_statfs(&err_no);
+    test_trace(&err_no);
+    test_bench(&err_no);
+
+    printf("\n-------------------------------\nFeature test Finished.\nCurrent Error Num: %d\n--------------------------------\n\n", err_no);
+    return 0;
+}
+
+/* The main testing program
+ */
+int main(int argc, char **argv){
+    feature_test();
+}
@@ -0,0 +1,393 @@
+#include "disk_emu.h"
+#include "sfs_api.h"
+#include <time.h>
+#include <unistd.h>
+
+// throughput and latency benchmark. for every fill level a fresh volume is filled
+// with FILL_FILE_BLOCKS block files up to that fraction of its data blocks, then the
+// workloads run in the space left: sequential and random reads and writes of a
+// BENCH_FILE_SIZE file at block aligned and unaligned sizes, small random writes,
+// file creation, open, close and removal, and mounting. every call is timed on its
+// own and each workload is reported with its throughput and latency percentiles.
+//
+// usage: ssfs_bench [-v] [-r reps] [-o output.json]
+// the volume is a NAME image in a fresh temporary directory, removed afterwards. the
+// error messages of the library go to stdout and are dropped unless -v is given
+
+#define BENCH_FILE_SIZE (32 * BLOCK_SIZE)
+#define FILL_FILE_BLOCKS NUM_POINTERS // one inode each
+#define SMALL_WRITE_SIZE 64
+#define SMALL_WRITES 256 // per rep
+#define META_FILES 16
+#define MOUNTS 20 // per rep
+
+static double fill_levels[] = {0.0, 0.25, 0.5, 0.7};
+static int io_sizes[] = {BLOCK_SIZE, 4 * BLOCK_SIZE, 1000, 3000}; // the last two are unaligned
+
+static FILE *out;
+static int reps = 5;
+static int first_result;
+static uint64_t *latencies;
+static int num_latencies;
+static uint64_t bytes_moved;
+static int failed;
+static char data[BENCH_FILE_SIZE];
+static uint32_t random_state = 1; // fixed, so the offsets are the same from run to run
+static char volume_dir[4096];
+static int verbose = 0;
+
+static uint64_t clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// xorshift, rand() is reseeded with the time whenever the disk is opened
+static uint32_t next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// starts collecting the latencies of a workload
+static void begin(int max_ops)
+{
+    free(latencies);
+    latencies = malloc(max_ops * sizeof(uint64_t));
+    num_latencies = 0;
+    bytes_moved = 0;
+    failed = 0;
+}
+
+// the latency in microseconds below which fraction p of the sorted calls fall
+static double percentile(double p)
+{
+    int k = (int)(p * (num_latencies - 1) + 0.5);
+    return latencies[k] / 1000.0;
+}
+
+// writes the collected latencies of a workload as one result object
+static void report(const char *name, int io_size)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < num_latencies; i++)
+        total += latencies[i];
+    qsort(latencies, num_latencies, sizeof(uint64_t), compare_u64);
+
+    fprintf(out, "%s        {\"name\": \"%s\", \"io_size\": %i, \"ops\": %i, \"errors\": %i, \"bytes\": %llu",
+            first_result ? "" : ",\n", name, io_size, num_latencies, failed, (unsigned long long)bytes_moved);
+    first_result = 0;
+    if (num_latencies == 0 || total == 0)
+    {
+        fprintf(out, "}");
+        return;
+    }
+    fprintf(out, ", \"seconds\": %.6f, \"ops_per_s\": %.1f, \"mb_per_s\": %.3f", total / 1e9, num_latencies * 1e9 / total, bytes_moved * 1e3 / total);
+    fprintf(out, ", \"latency_us\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}}",
+            total / 1000.0 / num_latencies, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), latencies[num_latencies - 1] / 1000.0);
+}
+
+// times one read or write call, result is what it returned
+static void record(uint64_t start, int result)
+{
+    latencies[num_latencies++] = clock_ns() - start;
+    if (result < 0)
+        failed++;
+    else
+        bytes_moved += result;
+}
+
+// random offset for an io_size transfer inside the file, a multiple of io_size when aligned
+static int random_offset(int io_size)
+{
+    int slots = BENCH_FILE_SIZE - io_size + 1;
+    if (io_size % BLOCK_SIZE == 0)
+        return next_random() % (BENCH_FILE_SIZE / io_size) * io_size;
+    return next_random() % slots;
+}
+
+// fills the volume with files of FILL_FILE_BLOCKS blocks up to level of its data blocks,
+// returns the fraction reached, lower when the inodes run out first
+static double fill_volume(double level)
+{
+    ssfs_statfs_t stats;
+    char name[32];
+
+    ssfs_statfs(&stats);
+    for (int n = 0; stats.total_blocks - stats.free_blocks + FILL_FILE_BLOCKS <= level * stats.total_blocks; n++)
+    {
+        sprintf(name, "fill%i", n);
+        int fd = ssfs_fopen(name);
+        if (fd < 0)
+            break;
+        int written = ssfs_fwrite(fd, data, FILL_FILE_BLOCKS * BLOCK_SIZE);
+        ssfs_fclose(fd);
+        if (written < 0)
+            break;
+        ssfs_statfs(&stats);
+    }
+    return (double)(stats.total_blocks - stats.free_blocks) / stats.total_blocks;
+}
+
+// writes the file from scratch io_size bytes at a time, the last copy stays for the reads
+static void bench_seq_write(int io_size)
+{
+    begin(reps * (BENCH_FILE_SIZE / io_size + 1));
+    for (int r = 0; r < reps; r++)
+    {
+        ssfs_remove("bench");
+        int fd = ssfs_fopen("bench");
+        for (int offset = 0; offset < BENCH_FILE_SIZE; offset += io_size)
+        {
+            int length = BENCH_FILE_SIZE - offset < io_size ? BENCH_FILE_SIZE - offset : io_size;
+            uint64_t start = clock_ns();
+            record(start, ssfs_fwrite(fd, data + offset, length));
+        }
+        ssfs_fclose(fd);
+    }
+    report("seq_write", io_size);
+}
+
+static void bench_seq_read(int fd, int io_size)
+{
+    char *buf = malloc(io_size);
+
+    begin(reps * (BENCH_FILE_SIZE / io_size + 1));
+    for (int r = 0; r < reps; r++)
+    {
+        ssfs_frseek(fd, 0);
+        for (int offset = 0; offset < BENCH_FILE_SIZE; offset += io_size)
+        {
+            uint64_t start = clock_ns();
+            record(start, ssfs_fread(fd, buf, io_size));
+        }
+    }
+    report("seq_read", io_size);
+    free(buf);
+}
+
+static void bench_rand_read(int fd, int io_size)
+{
+    char *buf = malloc(io_size);
+    int ops = reps * (BENCH_FILE_SIZE / io_size);
+
+    begin(ops);
+    for (int i = 0; i < ops; i++)
+    {
+        int offset = random_offset(io_size);
+        uint64_t start = clock_ns();
+        ssfs_frseek(fd, offset);
+        record(start, ssfs_fread(fd, buf, io_size));
+    }
+    report("rand_read", io_size);
+    free(buf);
+}
+
+static void bench_rand_write(int fd, const char *name, int io_size, int ops)
+{
+    begin(ops);
+    for (int i = 0; i < ops; i++)
+    {
+        int offset = random_offset(io_size);
+        uint64_t start = clock_ns();
+        ssfs_fwseek(fd, offset);
+        record(start, ssfs_fwrite(fd, data + offset, io_size));
+    }
+    report(name, io_size);
+}
+
+// creates, closes, reopens, closes and removes up to META_FILES empty files, a rate each
+static void bench_metadata()
+{
+    int fds[META_FILES];
+    char name[32];
+    int count = 0;
+    uint64_t start;
+
+    begin(reps * META_FILES);
+    for (int r = 0; r < reps; r++)
+    {
+        for (count = 0; count < META_FILES; count++)
+        {
+            sprintf(name, "meta%i", count);
+            start = clock_ns();
+            fds[count] = ssfs_fopen(name);
+            record(start, fds[count] < 0 ? -1 : 0);
+            if (fds[count] < 0)
+                break;
+        }
+        for (int i = 0; i < count; i++)
+            ssfs_fclose(fds[i]);
+        for (int i = 0; i < count; i++)
+        {
+            sprintf(name, "meta%i", i);
+            ssfs_remove(name);
+        }
+    }
+    report("fopen_create", 0);
+
+    // the files stay for the last three
+    for (count = 0; count < META_FILES; count++)
+    {
+        sprintf(name, "meta%i", count);
+        fds[count] = ssfs_fopen(name);
+        if (fds[count] < 0)
+            break;
+        ssfs_fclose(fds[count]);
+    }
+
+    begin(reps * META_FILES);
+    for (int r = 0; r < reps; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sprintf(name, "meta%i", i);
+            start = clock_ns();
+            fds[i] = ssfs_fopen(name);
+            record(start, fds[i] < 0 ? -1 : 0);
+        }
+        for (int i = 0; i < count; i++)
+            ssfs_fclose(fds[i]);
+    }
+    report("fopen_existing", 0);
+
+    begin(reps * META_FILES);
+    for (int r = 0; r < reps; r++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sprintf(name, "meta%i", i);
+            fds[i] = ssfs_fopen(name);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            start = clock_ns();
+            record(start, ssfs_fclose(fds[i]) < 0 ? -1 : 0);
+        }
+    }
+    report("fclose", 0);
+
+    begin(META_FILES);
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(name, "meta%i", i);
+        start = clock_ns();
+        record(start, ssfs_remove(name) < 0 ? -1 : 0);
+    }
+    report("remove", 0);
+}
+
+static void bench_mount()
+{
+    begin(reps * MOUNTS);
+    for (int i = 0; i < reps * MOUNTS; i++)
+    {
+        uint64_t start = clock_ns();
+        mkssfs(0);
+        record(start, 0);
+    }
+    report("mount", 0);
+}
+
+static void bench_level(double level)
+{
+    int num_sizes = sizeof(io_sizes) / sizeof(io_sizes[0]);
+
+    mkssfs(1);
+    double fill = fill_volume(level);
+    fprintf(out, "    {\"fill_target\": %.2f, \"fill\": %.3f, \"results\": [\n", level, fill);
+    first_result = 1;
+
+    for (int s = 0; s < num_sizes; s++)
+    {
+        bench_seq_write(io_sizes[s]);
+        int fd = ssfs_fopen("bench");
+        bench_seq_read(fd, io_sizes[s]);
+        bench_rand_read(fd, io_sizes[s]);
+        bench_rand_write(fd, "rand_write", io_sizes[s], reps * (BENCH_FILE_SIZE / io_sizes[s]));
+        ssfs_fclose(fd);
+    }
+
+    int fd = ssfs_fopen("bench");
+    bench_rand_write(fd, "small_write", SMALL_WRITE_SIZE, reps * SMALL_WRITES);
+    ssfs_fclose(fd);
+    ssfs_remove("bench");
+
+    bench_metadata();
+    bench_mount();
+    fprintf(out, "\n    ]}");
+}
+
+int main(int argc, char **argv)
+{
+    char *output = "bench.json";
+    int num_levels = sizeof(fill_levels) / sizeof(fill_levels[0]);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vr:o:")) != -1)
+    {
+        if (opt == 'v')
+            verbose = 1;
+        else if (opt == 'r')
+            reps = atoi(optarg);
+        else if (opt == 'o')
+            output = optarg;
+        else
+        {
+            fprintf(stderr, "usage: %s [-v] [-r reps] [-o output.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (reps < 1)
+        reps = 1;
+
+    // the output is opened before leaving the current directory, so a relative path stays one
+    out = fopen(output, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "ERROR (ssfs_bench): could not open %s.\n", output);
+        return 1;
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(volume_dir, sizeof(volume_dir), "%s/ssfs_bench.XXXXXX", tmp != NULL && *tmp != '\0' ? tmp : "/tmp");
+    if (mkdtemp(volume_dir) == NULL || chdir(volume_dir) != 0)
+    {
+        fprintf(stderr, "ERROR (ssfs_bench): could not create a directory for the volume.\n");
+        return 1;
+    }
+    if (!verbose)
+        freopen("/dev/null", "w", stdout);
+
+    for (int i = 0; i < BENCH_FILE_SIZE; i++)
+        data[i] = 'a' + next_random() % 26;
+
+    fprintf(out, "{\"benchmark\": \"ssfs_bench\", \"block_size\": %i, \"num_blocks\": %i, \"file_size\": %i, \"reps\": %i, \"levels\": [\n",
+            BLOCK_SIZE, NUM_BLOCKS, BENCH_FILE_SIZE, reps);
+    for (int l = 0; l < num_levels; l++)
+    {
+        bench_level(fill_levels[l]);
+        fprintf(out, "%s\n", l < num_levels - 1 ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
+    free(latencies);
+
+    close_disk();
+    unlink(NAME);
+    chdir("/");
+    rmdir(volume_dir);
+    fprintf(stderr, "ssfs_bench: results written to %s\n", output);
+    return 0;
+}
@@ -0,0 +1,558 @@
+#include "disk_emu.h"
+#include "sfs_api.h"
+#include "sfs_internal.h"
+#include <pthread.h>
+#include <unistd.h>
+
+// offline consistency checker for a ssfs image. the directory tree and the
+// indirect chains are walked first to find every reachable inode, then the
+// block maps of the reachable inodes are checked in parallel, each thread
+// building its own block bitmap over a range of inodes. the per-thread
+// bitmaps are merged and compared against the free bitmap a word at a time,
+// and the number of files and snapshots owning each block against its share count.
+//
+// usage: ssfs_fsck [-r] [-j threads] [image]
+// exit status: 0 clean, 1 errors found and repaired, 4 errors left
+
+#define FSCK_MAX_THREADS 64
+#define BITMAP_WORDS (NUM_DATA_BLOCKS / 32)
+
+typedef struct
+{
+    int first_inode;
+    int last_inode; // exclusive
+    uint32_t refs[BITMAP_WORDS];
+    int owners[NUM_DATA_BLOCKS]; // files referencing each block
+    int bad_pointers;
+} fsck_range_t;
+
+static super_block_t sb;
+static inode_t inodes[NUM_INODES];
+static bitmap_t disk_bitmap;
+static uint8_t block_shares[NUM_DATA_BLOCKS];
+_Static_assert(sizeof(block_shares) <= BLOCK_SIZE, "the share counts must fit in SHARES_BLOCK");
+static uint32_t block_hashes[NUM_DATA_BLOCKS];
+static char reachable[NUM_INODES];
+static int repair = 0;
+static int errors = 0;
+static int unrepaired = 0;
+static int inode_table_dirty = 0;
+
+// name heap as read from the image, with the live bytes the entries actually use.
+// names are only checked against a heap that loaded whole
+static int heap_loaded = 0;
+static int heap_blocks = 0;
+static char *heap = NULL;
+static int *heap_used = NULL;
+
+// a finding that -r fixes
+static void report(const char *fmt, int a, int b)
+{
+    printf("  ");
+    printf(fmt, a, b);
+    printf("%s\n", repair ? " (repaired)" : "");
+    errors++;
+}
+
+// a finding that -r leaves as it is
+static void report_unrepaired(const char *fmt, int a, int b)
+{
+    printf("  ");
+    printf(fmt, a, b);
+    printf("\n");
+    errors++;
+    unrepaired++;
+}
+
+static int inode_in_use(int inode_index)
+{
+    return inode_index >= 0 && inode_index < NUM_INODES && inodes[inode_index].size != -1;
+}
+
+static int valid_data_block(int block_index)
+{
+    return block_index >= FIRST_DATA_BLOCK && block_index < NUM_DATA_BLOCKS;
+}
+
+// maps a block of a file to its disk block, -1 when it is not mapped.
+// the walk is bounded so a looping chain cannot hang the checker
+static int file_block(int inode_index, int block)
+{
+    for (int hops = 0; hops < NUM_INODES && inode_in_use(inode_index); hops++)
+    {
+        if (block < NUM_POINTERS)
+        {
+            int block_index = inodes[inode_index].pointers[block];
+            return valid_data_block(block_index) ? block_index : -1;
+        }
+        block -= NUM_POINTERS;
+        inode_index = inodes[inode_index].ind_pointer;
+    }
+    return -1;
+}
+
+// marks the indirect chain of a file reachable, cutting it where it leaves
+// the inode table, reaches a free inode or runs into an inode already reached
+static void walk_chain(int inode_index)
+{
+    int prev = inode_index;
+    int next = inodes[inode_index].ind_pointer;
+
+    while (next != -1)
+    {
+        if (!inode_in_use(next) || reachable[next] || inodes[next].flags != 0)
+        {
+            report("inode %i: bad indirect pointer %i", prev, next);
+            if (repair)
+            {
+                inodes[prev].ind_pointer = -1;
+                inode_table_dirty = 1;
+            }
+            return;
+        }
+        reachable[next] = 1;
+        prev = next;
+        next = inodes[next].ind_pointer;
+    }
+}
+
+// loads the name heap so directory entries can be checked against it
+static void load_heap()
+{
+    int heap_inode = sb.name_heap;
+
+    if (!inode_in_use(heap_inode) || !(inodes[heap_inode].flags & INODE_HEAP))
+    {
+        report_unrepaired("name heap inode %i is missing", heap_inode, 0);
+        return;
+    }
+    reachable[heap_inode] = 1;
+    walk_chain(heap_inode);
+
+    heap_blocks = inodes[heap_inode].size / BLOCK_SIZE;
+    heap = calloc(heap_blocks + 1, BLOCK_SIZE);
+    heap_used = calloc(heap_blocks + 1, sizeof(int));
+    heap_loaded = 1;
+    for (int b = 0; b < heap_blocks; b++)
+    {
+        int block_index = file_block(heap_inode, b);
+        if (block_index == -1)
+        {
+            report_unrepaired("name heap block %i is not mapped", b, 0);
+            heap_loaded = 0;
+        }
+        else
+            read_blocks(block_index, 1, heap + b * BLOCK_SIZE);
+    }
+}
+
+// checks one directory entry, returns 0 when it has to be cleared
+static int check_dirent(int dir, dirent_t *entry)
+{
+    int b = entry->name_offset / BLOCK_SIZE;
+    int offset = entry->name_offset % BLOCK_SIZE;
+    int tail = 0;
+
+    if (!inode_in_use(entry->inode))
+    {
+        report("directory %i: entry points to free inode %i", dir, entry->inode);
+        return 0;
+    }
+    if (reachable[entry->inode])
+    {
+        report("directory %i: inode %i is linked twice", dir, entry->inode);
+        return 0;
+    }
+    // without the whole heap a name cannot be told apart from a lost block
+    if (!heap_loaded)
+        return 1;
+
+    if (entry->name_offset >= 0 && b < heap_blocks)
+        memcpy(&tail, heap + b * BLOCK_SIZE, sizeof(int));
+    if (entry->name_len <= 0 || entry->name_len > MAX_NAME_LEN || entry->name_offset < 0 || b >= heap_blocks ||
+        offset < NAME_HEAP_HEADER || offset + entry->name_len > tail)
+    {
+        report("directory %i: inode %i has an invalid name", dir, entry->inode);
+        return 0;
+    }
+    if (hash_name(heap + entry->name_offset, entry->name_len) != entry->hash)
+    {
+        report("directory %i: inode %i has a bad name hash", dir, entry->inode);
+        return 0;
+    }
+
+    heap_used[b] += entry->name_len;
+    return 1;
+}
+
+// walks the directory tree from the root, breadth first
+static void walk_directories()
+{
+    int queue[NUM_INODES + 1];
+    int head = 0;
+    int tail = 0;
+    dirent_t entries[DIRENTS_PER_BLOCK];
+
+    queue[tail++] = ROOT_DIR;
+    while (head < tail)
+    {
+        int dir = queue[head++];
+        int nblocks = dir == ROOT_DIR ? ROOT_DIR_BLOCKS : inodes[dir].size / BLOCK_SIZE;
+
+        for (int b = 0; b < nblocks; b++)
+        {
+            int block_index = dir == ROOT_DIR ? sb.root_start + b : file_block(dir, b);
+            int dirty = 0;
+
+            if (block_index == -1)
+            {
+                report_unrepaired("directory %i: block %i is not mapped", dir, b);
+                continue;
+            }
+            read_blocks(block_index, 1, entries);
+
+            for (int i = 0; i < DIRENTS_PER_BLOCK; i++)
+            {
+                if (entries[i].inode == DIRENT_EMPTY || entries[i].inode == DIRENT_DELETED)
+                    continue;
+                if (!check_dirent(dir, &entries[i]))
+                {
+                    memset(&entries[i], 0, sizeof(dirent_t));
+                    entries[i].inode = DIRENT_DELETED;
+                    dirty = 1;
+                    continue;
+                }
+
+                reachable[entries[i].inode] = 1;
+                walk_chain(entries[i].inode);
+                if (inodes[entries[i].inode].flags & INODE_DIR)
+                    queue[tail++] = entries[i].inode;
+            }
+
+            if (dirty && repair)
+                write_blocks(block_index, 1, entries);
+        }
+    }
+}
+
+// checks the block maps of the reachable inodes of one range
+static void *check_range(void *arg)
+{
+    fsck_range_t *range = arg;
+
+    for (int i = range->first_inode; i < range->last_inode; i++)
+    {
+        if (!reachable[i])
+            continue;
+        if (inodes[i].flags & INODE_INLINE)
+        {
+            if (inodes[i].size > INLINE_MAX_SIZE)
+            {
+                range->bad_pointers++;
+                printf("  inode %i: inline size %i too large%s\n", i, inodes[i].size, repair ? " (repaired)" : "");
+                if (repair)
+                    inodes[i].size = INLINE_MAX_SIZE;
+            }
+            continue;
+        }
+
+        for (int j = 0; j < NUM_POINTERS; j++)
+        {
+            int block_index = inodes[i].pointers[j];
+            if (block_index == -1)
+                continue;
+            if (!valid_data_block(block_index))
+            {
+                range->bad_pointers++;
+                printf("  inode %i: pointer %i out of range (%i)%s\n", i, j, block_index, repair ? " (repaired)" : "");
+                // the ranges never share an inode, so the repair needs no lock
+                if (repair)
+                    inodes[i].pointers[j] = -1;
+                continue;
+            }
+            range->owners[block_index]++;
+            set_bit(range->refs, block_index);
+        }
+
+        // a packed tail is one owner of its tail block, a bad one is cut off the file
+        if (inodes[i].flags & INODE_TAIL)
+        {
+            int length = inodes[i].size % BLOCK_SIZE;
+            if (!valid_data_block(inodes[i].tail_block) || inodes[i].tail_offset < 0 || inodes[i].tail_offset + length > BLOCK_SIZE)
+            {
+                range->bad_pointers++;
+                printf("  inode %i: tail at block %i offset %i out of range%s\n", i, inodes[i].tail_block, inodes[i].tail_offset, repair ? " (repaired)" : "");
+                if (repair)
+                {
+                    inodes[i].flags &= ~INODE_TAIL;
+                    inodes[i].size -= length;
+                }
+                continue;
+            }
+            range->owners[inodes[i].tail_block]++;
+            set_bit(range->refs, inodes[i].tail_block);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    char *image = NAME;
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    fsck_range_t *ranges;
+    pthread_t threads[FSCK_MAX_THREADS];
+    uint32_t refs[BITMAP_WORDS] = {0};
+    int owners[NUM_DATA_BLOCKS] = {0};
+    int bad_shares = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rj:")) != -1)
+    {
+        if (opt == 'r')
+            repair = 1;
+        else if (opt == 'j')
+            num_threads = atoi(optarg);
+        else
+        {
+            printf("usage: %s [-r] [-j threads] [image]\n", argv[0]);
+            return 8;
+        }
+    }
+    if (optind < argc)
+        image = argv[optind];
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > FSCK_MAX_THREADS)
+        num_threads = FSCK_MAX_THREADS;
+    if (num_threads > NUM_INODES)
+        num_threads = NUM_INODES;
+
+    if (init_disk(image, BLOCK_SIZE, NUM_BLOCKS) != 0)
+    {
+        printf("ERROR (ssfs_fsck): could not open %s.\n", image);
+        return 8;
+    }
+
+    // the super block has to be right before anything else can be trusted
+    char *table = malloc(NUM_INODE_BLOCKS * BLOCK_SIZE);
+    read_blocks(0, 1, table);
+    memcpy(&sb, table, sizeof(sb));
+    if (sb.id != MAGIC_NUM || sb.block_size != BLOCK_SIZE || sb.num_blocks != NUM_BLOCKS ||
+        sb.num_inodes != NUM_INODES || sb.root_start != ROOT_DIR_START || sb.root_blocks != ROOT_DIR_BLOCKS ||
+        sb.inode_start < 1 || sb.inode_start + NUM_INODE_BLOCKS > sb.root_start)
+    {
+        printf("ERROR (ssfs_fsck): %s is not a ssfs volume of this version.\n", image);
+        return 8;
+    }
+
+    read_blocks(sb.inode_start, NUM_INODE_BLOCKS, table);
+    for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+    {
+        int count = NUM_INODES - b * INODES_PER_BLOCK < INODES_PER_BLOCK ? NUM_INODES - b * INODES_PER_BLOCK : INODES_PER_BLOCK;
+        memcpy(&inodes[b * INODES_PER_BLOCK], table + b * BLOCK_SIZE, count * sizeof(inode_t));
+    }
+    read_blocks(NUM_BLOCKS - 1, 1, &disk_bitmap);
+    read_blocks(SHARES_BLOCK, 1, table);
+    memcpy(block_shares, table, sizeof(block_shares));
+    read_blocks(DEDUP_START, DEDUP_BLOCKS, block_hashes);
+
+    printf("ssfs_fsck: checking %s with %i threads\n", image, num_threads);
+
+    // reachability: name heap, then the directory tree
+    load_heap();
+    walk_directories();
+
+    // name heap blocks whose live count disagrees with their entries
+    for (int b = 0; heap_loaded && b < heap_blocks; b++)
+    {
+        int header[2];
+        memcpy(header, heap + b * BLOCK_SIZE, sizeof(header));
+        if (header[1] != heap_used[b])
+        {
+            // write_blocks would take -1 as a position, so an unmapped block is left alone
+            int block_index = file_block(sb.name_heap, b);
+            if (block_index == -1)
+            {
+                report_unrepaired("name heap block %i: %i live bytes recorded", b, header[1]);
+                continue;
+            }
+            report("name heap block %i: %i live bytes recorded", b, header[1]);
+            header[1] = heap_used[b];
+            if (header[1] == 0)
+                header[0] = NAME_HEAP_HEADER;
+            memcpy(heap + b * BLOCK_SIZE, header, sizeof(header));
+            if (repair)
+                write_blocks(block_index, 1, heap + b * BLOCK_SIZE);
+        }
+    }
+
+    // leaked inodes are in use but unreachable, their blocks are not counted
+    for (int i = 0; i < NUM_INODES; i++)
+    {
+        if (inode_in_use(i) && !reachable[i])
+        {
+            report("inode %i is leaked", i, 0);
+            if (repair)
+            {
+                inodes[i].size = -1;
+                inodes[i].ind_pointer = -1;
+                inodes[i].flags = 0;
+                for (int j = 0; j < NUM_POINTERS; j++)
+                    inodes[i].pointers[j] = -1;
+                inode_table_dirty = 1;
+            }
+        }
+    }
+
+    // block maps, an even range of inodes per thread
+    ranges = calloc(num_threads, sizeof(fsck_range_t));
+    for (int t = 0; t < num_threads; t++)
+    {
+        ranges[t].first_inode = NUM_INODES * t / num_threads;
+        ranges[t].last_inode = NUM_INODES * (t + 1) / num_threads;
+        pthread_create(&threads[t], NULL, check_range, &ranges[t]);
+    }
+    for (int t = 0; t < num_threads; t++)
+    {
+        pthread_join(threads[t], NULL);
+
+        for (int w = 0; w < BITMAP_WORDS; w++)
+        {
+            // owners only need adding up where a block is referenced at all
+            for (uint32_t bits = ranges[t].refs[w]; bits != 0; bits &= bits - 1)
+            {
+                int block_index = w * 32 + __builtin_ctz(bits);
+                owners[block_index] += ranges[t].owners[block_index];
+            }
+            refs[w] |= ranges[t].refs[w];
+        }
+        errors += ranges[t].bad_pointers;
+        if (ranges[t].bad_pointers > 0)
+            inode_table_dirty = 1;
+    }
+
+    // snapshots own their frozen tables and every block their inodes reference
+    for (int n = 0; n < MAX_SNAPSHOTS; n++)
+    {
+        int start = sb.snapshots[n];
+        if (start == -1)
+            continue;
+        if (start < FIRST_DATA_BLOCK || start + SNAPSHOT_BLOCKS > NUM_DATA_BLOCKS)
+        {
+            printf("  snapshot %i starts at invalid block %i\n", n, start);
+            errors++;
+            unrepaired++;
+            continue;
+        }
+        for (int k = 0; k < SNAPSHOT_BLOCKS; k++)
+        {
+            set_bit(refs, start + k);
+            owners[start + k]++;
+        }
+
+        inode_t *frozen = malloc(NUM_INODE_BLOCKS * BLOCK_SIZE);
+        read_blocks(start + 1, NUM_INODE_BLOCKS, frozen);
+        for (int i = 0; i < NUM_INODES; i++)
+        {
+            for (int j = 0; frozen[i].size != -1 && !(frozen[i].flags & INODE_INLINE) && j < NUM_POINTERS; j++)
+            {
+                if (valid_data_block(frozen[i].pointers[j]))
+                {
+                    set_bit(refs, frozen[i].pointers[j]);
+                    owners[frozen[i].pointers[j]]++;
+                }
+            }
+            if (frozen[i].size != -1 && (frozen[i].flags & INODE_TAIL) && valid_data_block(frozen[i].tail_block))
+            {
+                set_bit(refs, frozen[i].tail_block);
+                owners[frozen[i].tail_block]++;
+            }
+        }
+        free(frozen);
+    }
+
+    // a block referenced by n owners has to record n - 1 shares, see ssfs_clone
+    for (int i = FIRST_DATA_BLOCK; i < NUM_DATA_BLOCKS; i++)
+    {
+        int expected = owners[i] > 0 ? owners[i] - 1 : 0;
+        if (block_shares[i] == expected)
+            continue;
+        printf("  block %i has %i owners but records %i shares%s\n", i, owners[i], block_shares[i], repair && expected <= MAX_BLOCK_SHARES ? " (repaired)" : "");
+        errors++;
+        if (expected > MAX_BLOCK_SHARES)
+            unrepaired++;
+        block_shares[i] = expected > MAX_BLOCK_SHARES ? MAX_BLOCK_SHARES : expected;
+        bad_shares = 1;
+    }
+
+    // compare against the free bitmap a word at a time, reserved blocks always count as used
+    int used = 0;
+    int leaked = 0;
+    int missing = 0;
+    for (int i = 0; i < FIRST_DATA_BLOCK; i++)
+        set_bit(refs, i);
+    for (int w = 0; w < BITMAP_WORDS; w++)
+    {
+        uint32_t disk = disk_bitmap.bits[w];
+        used += __builtin_popcount(refs[w]);
+        leaked += __builtin_popcount(disk & ~refs[w]);
+        missing += __builtin_popcount(refs[w] & ~disk);
+        disk_bitmap.bits[w] = refs[w];
+    }
+    if (leaked > 0)
+        report("%i blocks are marked used but not referenced", leaked, 0);
+    if (missing > 0)
+        report("%i blocks are referenced but marked free", missing, 0);
+
+    // a freed block loses its fingerprint, so one left on an unreferenced block is stale
+    int stale = 0;
+    for (int i = FIRST_DATA_BLOCK; i < NUM_DATA_BLOCKS; i++)
+    {
+        if (block_hashes[i] != 0 && !test_bit(refs, i))
+        {
+            block_hashes[i] = 0;
+            stale++;
+        }
+    }
+    if (stale > 0)
+        report("%i unreferenced blocks keep a dedup fingerprint", stale, 0);
+
+    if (repair)
+    {
+        if (leaked > 0 || missing > 0)
+            write_blocks(NUM_BLOCKS - 1, 1, &disk_bitmap);
+        if (bad_shares)
+        {
+            char buffer[BLOCK_SIZE] = {0};
+            memcpy(buffer, block_shares, sizeof(block_shares));
+            write_blocks(SHARES_BLOCK, 1, buffer);
+        }
+        if (stale > 0)
+            write_blocks(DEDUP_START, DEDUP_BLOCKS, block_hashes);
+        if (inode_table_dirty)
+        {
+            memset(table, 0, NUM_INODE_BLOCKS * BLOCK_SIZE);
+            for (int b = 0; b < NUM_INODE_BLOCKS; b++)
+            {
+                int count = NUM_INODES - b * INODES_PER_BLOCK < INODES_PER_BLOCK ? NUM_INODES - b * INODES_PER_BLOCK : INODES_PER_BLOCK;
+                memcpy(table + b * BLOCK_SIZE, &inodes[b * INODES_PER_BLOCK], count * sizeof(inode_t));
+            }
+            write_blocks(sb.inode_start, NUM_INODE_BLOCKS, table);
+        }
+    }
+
+    int live_inodes = 0;
+    for (int i = 0; i < NUM_INODES; i++)
+        live_inodes += reachable[i];
+    printf("ssfs_fsck: %i/%i inodes, %i/%i blocks used, %i errors, %i not repairable\n", live_inodes, NUM_INODES, used, NUM_DATA_BLOCKS, errors, unrepaired);
+
+    free(table);
+    free(ranges);
+    free(heap);
+    free(heap_used);
+    close_disk();
+    if (errors == 0)
+        return 0;
+    return repair && unrepaired == 0 ? 1 : 4;
+}
@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <string.h>
+#include "ssfs_lz.h"
+
+// small LZ77 codec for compressed files. the output is a list of sequences, each a
+// token byte holding the literal count and the match length in a nibble each, the
+// literals, then a 2 byte offset back into the output and the rest of the match
+// length. a nibble of 15 continues in the following bytes, 255 at a time. the last
+// sequence only has literals, the end of the input ends it
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+// hash of the 4 bytes at p, indexes the table of last positions
+static uint32_t lz_hash(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the part of a length that did not fit its nibble, returns the new output
+// position or -1 if dst is full
+static int put_length(char *dst, int pos, int capacity, int length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (pos >= capacity)
+            return -1;
+        dst[pos++] = (char)255;
+    }
+    if (pos >= capacity)
+        return -1;
+    dst[pos++] = (char)length;
+    return pos;
+}
+
+// reads the part of a length that did not fit its nibble, -1 past the end of src
+static int get_length(const unsigned char *src, int *pos, int length)
+{
+    int total = 0;
+    int byte;
+
+    do
+    {
+        if (*pos >= length)
+            return -1;
+        byte = src[(*pos)++];
+        total += byte;
+    } while (byte == 255);
+    return total;
+}
+
+// writes one sequence, a match_length of 0 makes it the last one
+static int put_sequence(char *dst, int pos, int capacity, const char *literals, int literal_length, int offset, int match_length)
+{
+    int match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+
+    if (pos >= capacity)
+        return -1;
+    dst[pos++] = (char)(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_length >= 15 && (pos = put_length(dst, pos, capacity, literal_length - 15)) < 0)
+        return -1;
+    if (pos + literal_length > capacity)
+        return -1;
+    memcpy(dst + pos, literals, literal_length);
+    pos += literal_length;
+
+    if (match_length == 0)
+        return pos;
+    if (pos + 2 > capacity)
+        return -1;
+    dst[pos++] = (char)(offset & 0xff);
+    dst[pos++] = (char)(offset >> 8);
+    if (match_code >= 15 && (pos = put_length(dst, pos, capacity, match_code - 15)) < 0)
+        return -1;
+    return pos;
+}
+
+// compresses length bytes of src into dst, returns the compressed length or -1
+// if it does not fit in capacity bytes
+int lz_compress(const char *src, int length, char *dst, int capacity)
+{
+    int table[1 << LZ_HASH_BITS];
+    int anchor = 0;
+    int pos = 0;
+    int out = 0;
+
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+        table[i] = -1;
+
+    while (pos + LZ_MIN_MATCH <= length)
+    {
+        uint32_t h = lz_hash(src + pos);
+        int candidate = table[h];
+        table[h] = pos;
+        if (candidate < 0 || pos - candidate > LZ_MAX_OFFSET || memcmp(src + candidate, src + pos, LZ_MIN_MATCH) != 0)
+        {
+            pos++;
+            continue;
+        }
+
+        // extend the match as far as it goes, it may overlap the bytes it copies
+        int match_length = LZ_MIN_MATCH;
+        while (pos + match_length < length && src[candidate + match_length] == src[pos + match_length])
+            match_length++;
+
+        out = put_sequence(dst, out, capacity, src + anchor, pos - anchor, pos - candidate, match_length);
+        if (out < 0)
+            return -1;
+        pos += match_length;
+        anchor = pos;
+    }
+
+    return put_sequence(dst, out, capacity, src + anchor, length - anchor, 0, 0);
+}
+
+// decompresses length bytes of src into dst, returns the decompressed length or -1
+// if src is corrupt or does not fit in capacity bytes
+int lz_decompress(const char *src, int length, char *dst, int capacity)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    int pos = 0;
+    int out = 0;
+
+    while (pos < length)
+    {
+        int token = in[pos++];
+        int literal_length = token >> 4;
+        if (literal_length == 15)
+        {
+            int extra = get_length(in, &pos, length);
+            if (extra < 0)
+                return -1;
+            literal_length += extra;
+        }
+        if (pos + literal_length > length || out + literal_length > capacity)
+            return -1;
+        memcpy(dst + out, in + pos, literal_length);
+        pos += literal_length;
+        out += literal_length;
+
+        // the last sequence has no match
+        if (pos == length)
+            break;
+        if (pos + 2 > length)
+            return -1;
+        int offset = in[pos] | (in[pos + 1] << 8);
+        pos += 2;
+        int match_length = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15)
+        {
+            int extra = get_length(in, &pos, length);
+            if (extra < 0)
+                return -1;
+            match_length += extra;
+        }
+        if (offset == 0 || offset > out || out + match_length > capacity)
+            return -1;
+
+        // byte by byte, an overlapping match repeats what it just wrote
+        for (int i = 0; i < match_length; i++, out++)
+            dst[out] = dst[out - offset];
+    }
+    return out;
+}
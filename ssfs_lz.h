@@ -0,0 +1,2 @@
+int lz_compress(const char *src, int length, char *dst, int capacity);
+int lz_decompress(const char *src, int length, char *dst, int capacity);
@@ -711,3 +711,1705 @@ int free_name_element(char **name_list, int num_file){
         free(name_list[i]);
     return 0;
 }
+
+/*
+   Counts an error when a check of a feature test does not hold.
+   Returns the check so a test can stop early.
+ */
+int expect(int cond, char *what, int *err_no){
+    if(!cond) {
+        fprintf(stderr, "Error: %s\n", what);
+        *err_no += 1;
+    }
+    return cond;
+}
+
+/*
+   Runs the offline checker over the image the last test left behind. The checker
+   is $SSFS_FSCK or ./ssfs_fsck. Any error it reports, or not running at all, is an error.
+ */
+int test_fsck(int *err_no){
+    if(run_fsck("") != 0) {
+        fprintf(stderr, "Error: ssfs_fsck failed on %s\n", NAME);
+        *err_no += 1;
+    }
+    return 0;
+}
+
+/*
+   Runs ssfs_fsck with the given options on the volume, returns its exit status.
+ */
+int run_fsck(char *options){
+    char command[1024];
+    char *fsck = getenv("SSFS_FSCK");
+    int res;
+
+    snprintf(command, sizeof(command), "%s %s %s", fsck != NULL ? fsck : "./ssfs_fsck", options, NAME);
+    fflush(stdout);
+    res = system(command);
+    if(res == -1 || !WIFEXITED(res))
+        return -1;
+    return WEXITSTATUS(res);
+}
+
+/*
+   Waits for count completions of the async queue.
+ */
+int reap_all(ssfs_cqe_t *cqes, int count){
+    int reaped = 0;
+    while(reaped < count) {
+        int res = ssfs_async_reap(cqes + reaped, count - reaped, count - reaped);
+        if(res <= 0)
+            break;
+        reaped += res;
+    }
+    return reaped;
+}
+
+/*
+   Opens, closes and removes files on the calling thread while the async workers
+   run, enough of them at once to make the descriptor table grow.
+ */
+void *sync_opener(void *arg){
+    int *failed = arg;
+    int fds[64];
+    char name[32];
+
+    for(int i = 0; i < 64; i++) {
+        sprintf(name, "sync%d", i % 8);
+        fds[i] = ssfs_fopen(name);
+        if(fds[i] < 0 || ssfs_fwrite(fds[i], name, strlen(name)) < 0)
+            *failed += 1;
+    }
+    for(int i = 0; i < 64; i++)
+        ssfs_fclose(fds[i]);
+    for(int i = 0; i < 8; i++) {
+        sprintf(name, "sync%d", i);
+        ssfs_remove(name);
+    }
+    return NULL;
+}
+
+/*
+   Async queue: positional reads and writes that leave the descriptor pointers alone,
+   synchronous calls on another thread meanwhile, and the error paths.
+ */
+int test_async(int *err_no){
+    ssfs_sqe_t sqe;
+    ssfs_cqe_t cqes[8];
+    char bufs[4][100];
+    char buf[400];
+    pthread_t thread;
+    int failed = 0;
+    int fd;
+
+    mkssfs(1);
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.op = SSFS_OP_FOPEN;
+    sqe.name = "async.txt";
+    expect(ssfs_async_submit(&sqe) < 0, "ssfs_async_submit accepted an entry before ssfs_async_init", err_no);
+    expect(ssfs_async_init(0, 1) < 0, "ssfs_async_init accepted a queue depth of 0", err_no);
+    if(!expect(ssfs_async_init(8, 2) == 0, "ssfs_async_init failed", err_no))
+        return -1;
+    expect(ssfs_async_init(8, 2) < 0, "ssfs_async_init started a second queue", err_no);
+
+    ssfs_async_submit(&sqe);
+    expect(reap_all(cqes, 1) == 1, "the fopen completion never came", err_no);
+    fd = cqes[0].result;
+    expect(fd >= 0, "async fopen failed", err_no);
+
+    // four writes at their own offsets, submitted at once
+    pthread_create(&thread, NULL, sync_opener, &failed);
+    for(int i = 0; i < 4; i++) {
+        memset(bufs[i], 'a' + i, 100);
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.op = SSFS_OP_FWRITE;
+        sqe.fileID = fd;
+        sqe.buf = bufs[i];
+        sqe.length = 100;
+        sqe.offset = (3 - i) * 100;
+        ssfs_async_submit(&sqe);
+    }
+    expect(reap_all(cqes, 4) == 4, "the fwrite completions never came", err_no);
+    for(int i = 0; i < 4; i++)
+        expect(cqes[i].result == 100, "async fwrite did not write 100 bytes", err_no);
+    pthread_join(thread, NULL);
+    expect(failed == 0, "synchronous calls failed while the async workers ran", err_no);
+
+    // the descriptor's own pointers did not move
+    expect(ssfs_fread(fd, buf, 400) == 400, "fread after the async writes did not read 400 bytes", err_no);
+    for(int i = 0; i < 400; i++) {
+        if(!expect(buf[i] == 'a' + 3 - i / 100, "async fwrite put data at the wrong offset", err_no))
+            break;
+    }
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.op = SSFS_OP_FREAD;
+    sqe.fileID = fd;
+    sqe.buf = buf;
+    sqe.length = 100;
+    sqe.offset = 150;
+    ssfs_async_submit(&sqe);
+    sqe.offset = -1;
+    ssfs_async_submit(&sqe);
+    sqe.fileID = fd + 100;
+    sqe.offset = 0;
+    ssfs_async_submit(&sqe);
+    expect(reap_all(cqes, 3) == 3, "the fread completions never came", err_no);
+    for(int i = 0; i < 3; i++) {
+        if(cqes[i].result == 100)
+            expect(buf[0] == 'c' && buf[49] == 'c' && buf[50] == 'b' && buf[99] == 'b', "async fread read the wrong bytes", err_no);
+        else
+            expect(cqes[i].result == -1, "a bad async fread did not fail", err_no);
+    }
+
+    ssfs_fclose(fd);
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.op = SSFS_OP_REMOVE;
+    sqe.name = "async.txt";
+    ssfs_async_submit(&sqe);
+    expect(reap_all(cqes, 1) == 1 && cqes[0].result == 0, "async remove failed", err_no);
+    ssfs_async_shutdown();
+    fd = ssfs_fopen("async.txt");
+    expect(ssfs_fread(fd, buf, 10) == 0, "async remove left the file behind", err_no);
+    ssfs_fclose(fd);
+    ssfs_remove("async.txt");
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Mapped access: a writable mapping reaches the disk only for the ranges flagged
+   with ssfs_mdirty, a read-only one refuses ssfs_mdirty, and a file shrunk while
+   mapped shows zeros past its new end.
+ */
+int test_mmap(int *err_no){
+    char data[3000];
+    char buf[3000];
+    char *map;
+    int fd;
+
+    mkssfs(1);
+    for(int i = 0; i < 3000; i++)
+        data[i] = 'a' + i % 26;
+    fd = ssfs_fopen("mapped.txt");
+    ssfs_fwrite(fd, data, 3000);
+
+    expect(ssfs_mmap(fd, 0) == NULL, "ssfs_mmap accepted no flags", err_no);
+    expect(ssfs_mmap(fd + 100, SSFS_MAP_READ) == NULL, "ssfs_mmap accepted a bad descriptor", err_no);
+    expect(ssfs_mdirty(fd, 0, 1) < 0, "ssfs_mdirty accepted an unmapped file", err_no);
+    expect(ssfs_munmap(fd) < 0, "ssfs_munmap accepted an unmapped file", err_no);
+
+    map = ssfs_mmap(fd, SSFS_MAP_READ);
+    if(!expect(map != NULL, "read-only ssfs_mmap failed", err_no))
+        return -1;
+    expect(memcmp(map, data, 3000) == 0, "the mapping does not hold the file", err_no);
+    expect(ssfs_mdirty(fd, 0, 10) < 0, "ssfs_mdirty accepted a read-only mapping", err_no);
+    expect(ssfs_munmap(fd) == 0, "ssfs_munmap failed", err_no);
+
+    // only the flagged block reaches the disk
+    map = ssfs_mmap(fd, SSFS_MAP_READ | SSFS_MAP_WRITE);
+    if(!expect(map != NULL, "writable ssfs_mmap failed", err_no))
+        return -1;
+    memset(map, 'X', 10);
+    memset(map + 2000, 'Y', 10);
+    expect(ssfs_mdirty(fd, 2000, 10) == 0, "ssfs_mdirty failed", err_no);
+    expect(ssfs_mdirty(fd, 2995, 10) < 0, "ssfs_mdirty accepted a range past the end", err_no);
+    expect(ssfs_munmap(fd) == 0, "ssfs_munmap failed", err_no);
+    memset(data + 2000, 'Y', 10);
+    ssfs_frseek(fd, 0);
+    expect(ssfs_fread(fd, buf, 3000) == 3000 && memcmp(buf, data, 3000) == 0, "munmap wrote back the wrong blocks", err_no);
+
+    // shrinking a mapped file hides what was past the new end
+    map = ssfs_mmap(fd, SSFS_MAP_READ | SSFS_MAP_WRITE);
+    ssfs_mdirty(fd, 0, 3000);
+    expect(ssfs_ftruncate(fd, 100) == 0, "ssfs_ftruncate failed", err_no);
+    for(int i = 100; i < 1024; i++) {
+        if(!expect(map[i] == 0, "the mapping shows bytes past the end after ssfs_ftruncate", err_no))
+            break;
+    }
+    ssfs_munmap(fd);
+    ssfs_ftruncate(fd, 1000);
+    ssfs_frseek(fd, 0);
+    expect(ssfs_fread(fd, buf, 1000) == 1000 && memcmp(buf, data, 100) == 0, "the first 100 bytes did not survive", err_no);
+    for(int i = 100; i < 1000; i++) {
+        if(!expect(buf[i] == 0, "munmap wrote back bytes cut by ssfs_ftruncate", err_no))
+            break;
+    }
+    ssfs_fclose(fd);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Counts the data blocks that the free bitmap on the disk marks as free.
+ */
+int free_blocks(){
+    bitmap_t bitmap;
+    int count = 0;
+
+    read_blocks(NUM_BLOCKS - 1, 1, &bitmap);
+    for(int i = 0; i < NUM_DATA_BLOCKS; i++)
+        count += !((bitmap.bits[i / 32] >> (i % 32)) & 1);
+    return count;
+}
+
+/*
+   Preallocation: blocks are taken up front without changing the file size, a
+   later write into them takes no more, and the error paths are refused.
+ */
+int test_fallocate(int *err_no){
+    int before;
+    int after;
+    char data[10 * 1024];
+    char buf[10 * 1024];
+    int fd;
+
+    mkssfs(1);
+    fd = ssfs_fopen("prealloc.txt");
+    expect(ssfs_fallocate(fd + 100, 0, 1024) < 0, "ssfs_fallocate accepted a bad descriptor", err_no);
+    expect(ssfs_fallocate(fd, -1, 1024) < 0, "ssfs_fallocate accepted a negative offset", err_no);
+    expect(ssfs_fallocate(fd, 0, 0) < 0, "ssfs_fallocate accepted an empty range", err_no);
+
+    before = free_blocks();
+    expect(ssfs_fallocate(fd, 0, 10 * 1024) == 0, "ssfs_fallocate failed", err_no);
+    after = free_blocks();
+    expect(before - after == 10, "ssfs_fallocate did not take 10 blocks", err_no);
+    expect(ssfs_fread(fd, buf, 100) == 0, "ssfs_fallocate changed the file size", err_no);
+    expect(ssfs_fallocate(fd, 0, 10 * 1024) == 0, "a second ssfs_fallocate of the same range failed", err_no);
+
+    for(int i = 0; i < 10 * 1024; i++)
+        data[i] = 'a' + i % 26;
+    expect(ssfs_fwrite(fd, data, 10 * 1024) == 10 * 1024, "fwrite into preallocated blocks failed", err_no);
+    before = free_blocks();
+    expect(before == after, "fwrite into preallocated blocks took more blocks", err_no);
+    ssfs_frseek(fd, 0);
+    expect(ssfs_fread(fd, buf, 10 * 1024) == 10 * 1024 && memcmp(buf, data, 10 * 1024) == 0, "preallocated file did not read back", err_no);
+
+    // more than the volume holds
+    expect(ssfs_fallocate(fd, 0, 2 * NUM_BLOCKS * 1024) < 0, "ssfs_fallocate past the volume size succeeded", err_no);
+    ssfs_fclose(fd);
+    ssfs_remove("prealloc.txt");
+    after = free_blocks();
+    expect(after == before + 10, "remove did not give the preallocated blocks back", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Truncation: shrinking releases the blocks and indirect inode past the new end
+   and pulls back the descriptor pointers, growing leaves a hole that reads as zeros.
+ */
+int test_ftruncate(int *err_no){
+    char data[20 * 1024];
+    char buf[20 * 1024];
+    int blocks, inodes;
+    int fd;
+
+    mkssfs(1);
+    for(int i = 0; i < 20 * 1024; i++)
+        data[i] = 'a' + i % 26;
+    fd = ssfs_fopen("truncated.txt");
+    ssfs_fwrite(fd, data, 20 * 1024);
+    expect(ssfs_ftruncate(fd + 100, 0) < 0, "ssfs_ftruncate accepted a bad descriptor", err_no);
+    expect(ssfs_ftruncate(fd, -1) < 0, "ssfs_ftruncate accepted a negative size", err_no);
+
+    // 20 blocks need an indirect inode, 5 do not
+    ssfs_frseek(fd, 15000);
+    inodes = free_inodes();
+    blocks = free_blocks();
+    expect(ssfs_ftruncate(fd, 5000) == 0, "ssfs_ftruncate failed", err_no);
+    expect(free_blocks() - blocks == 15, "ssfs_ftruncate did not release 15 blocks", err_no);
+    expect(free_inodes() - inodes == 1, "ssfs_ftruncate did not release the indirect inode", err_no);
+
+    // both pointers were pulled back to the new end, so this appends and reads it back
+    ssfs_fwrite(fd, "end", 3);
+    expect(ssfs_fread(fd, buf, 3) == 3 && memcmp(buf, "end", 3) == 0, "the pointers were not pulled back to the new end", err_no);
+    ssfs_frseek(fd, 0);
+    expect(ssfs_fread(fd, buf, 5000) == 5000 && memcmp(buf, data, 5000) == 0, "the first 5000 bytes did not survive", err_no);
+
+    blocks = free_blocks();
+    expect(ssfs_ftruncate(fd, 12000) == 0, "growing with ssfs_ftruncate failed", err_no);
+    expect(free_blocks() == blocks, "growing with ssfs_ftruncate allocated blocks", err_no);
+    ssfs_frseek(fd, 5003);
+    expect(ssfs_fread(fd, buf, 20 * 1024) == 12000 - 5003, "the grown file has the wrong size", err_no);
+    for(int i = 0; i < 12000 - 5003; i++) {
+        if(!expect(buf[i] == 0, "the grown part of the file is not zero", err_no))
+            break;
+    }
+
+    expect(ssfs_ftruncate(fd, 0) == 0, "ssfs_ftruncate to 0 failed", err_no);
+    expect(free_blocks() - blocks == 5, "ssfs_ftruncate to 0 did not release every block", err_no);
+    ssfs_frseek(fd, 0);
+    expect(ssfs_fread(fd, buf, 10) == 0, "the file is not empty after ssfs_ftruncate to 0", err_no);
+    ssfs_fclose(fd);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Counts the free inodes by creating empty files until that fails, then removes them.
+ */
+int free_inodes(){
+    char name[32];
+    int count = 0;
+    int fd;
+
+    for(;; count++) {
+        sprintf(name, "probe%d", count);
+        fd = ssfs_fopen(name);
+        if(fd < 0)
+            break;
+        ssfs_fclose(fd);
+    }
+    for(int i = 0; i < count; i++) {
+        sprintf(name, "probe%d", i);
+        ssfs_remove(name);
+    }
+    return count;
+}
+
+/*
+   Tells whether a file is gone, opening it again has to give an empty file.
+   The file opened to check is removed again.
+ */
+int file_is_gone(char *name){
+    char buf[8];
+    int fd = ssfs_fopen(name);
+    int gone = fd >= 0 && ssfs_fread(fd, buf, sizeof(buf)) == 0;
+    ssfs_fclose(fd);
+    ssfs_remove(name);
+    return gone;
+}
+
+/*
+   Batched removal: every name gets its own result, the blocks and inodes of every
+   removed file come back and descriptors open on them stop working. Prefix removal
+   takes exactly the names starting with the prefix.
+ */
+int test_remove_batch(int *err_no){
+    char *files[] = {"log.1", "log.2", "keep.1"};
+    char *names[] = {"log.1", "log.2", "missing", "log.1", NULL, "dir", "keep.1"};
+    int expected[] = {0, 0, -1, -1, -1, -1, 0};
+    int results[7];
+    char name[32];
+    int blocks, inodes;
+    int open_fd;
+    int fd;
+
+    mkssfs(1);
+    inodes = free_inodes();
+    blocks = free_blocks();
+    for(int i = 0; i < 3; i++) {
+        fd = ssfs_fopen(files[i]);
+        ssfs_fwrite(fd, test_str, strlen(test_str));
+        ssfs_fclose(fd);
+    }
+    ssfs_mkdir("dir");
+    open_fd = ssfs_fopen("log.2");
+
+    expect(ssfs_remove_batch(NULL, 1, results) < 0, "ssfs_remove_batch accepted a NULL list", err_no);
+    expect(ssfs_remove_batch(names, -1, results) < 0, "ssfs_remove_batch accepted a negative count", err_no);
+    expect(ssfs_remove_batch(names, 0, results) == 0, "ssfs_remove_batch of no names removed something", err_no);
+
+    expect(ssfs_remove_batch(names, 7, results) == 3, "ssfs_remove_batch did not remove 3 files", err_no);
+    for(int i = 0; i < 7; i++) {
+        sprintf(name, "wrong result for name %d", i);
+        expect(results[i] == expected[i], name, err_no);
+    }
+    expect(ssfs_fwrite(open_fd, "x", 1) < 0, "a descriptor of a removed file still works", err_no);
+    expect(file_is_gone("log.1") && file_is_gone("log.2") && file_is_gone("keep.1"), "a removed file is still there", err_no);
+    expect(ssfs_rmdir("dir") == 0, "ssfs_remove_batch touched a directory", err_no);
+    expect(free_blocks() == blocks && free_inodes() == inodes, "ssfs_remove_batch leaked blocks or inodes", err_no);
+
+    // prefix removal
+    for(int i = 0; i < 6; i++) {
+        sprintf(name, i < 4 ? "tmp.%d" : "other.%d", i);
+        fd = ssfs_fopen(name);
+        ssfs_fwrite(fd, test_str, strlen(test_str));
+        ssfs_fclose(fd);
+    }
+    expect(ssfs_remove_prefix(NULL) < 0, "ssfs_remove_prefix accepted NULL", err_no);
+    expect(ssfs_remove_prefix("nothing") == 0, "ssfs_remove_prefix removed names it does not start", err_no);
+    expect(ssfs_remove_prefix("tmp.") == 4, "ssfs_remove_prefix did not remove 4 files", err_no);
+    expect(ssfs_remove_prefix("") == 2, "ssfs_remove_prefix of everything did not remove the 2 files left", err_no);
+    expect(free_blocks() == blocks && free_inodes() == inodes, "removal leaked blocks or inodes", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Descriptor table: it grows past its initial size on demand, every descriptor is
+   distinct and works, a closed one is handed out again and closed or out of range
+   descriptors are refused.
+ */
+int test_fd_table(int *err_no){
+    int fds[100];
+    char name[32];
+    char buf[64];
+    int distinct = 1;
+    int fd;
+
+    mkssfs(1);
+    for(int i = 0; i < 100; i++) {
+        sprintf(name, "fd%d", i % 10);
+        fds[i] = ssfs_fopen(name);
+        if(!expect(fds[i] >= 0, "ssfs_fopen failed while the table grew", err_no))
+            return -1;
+    }
+    for(int i = 0; i < 100; i++)
+        for(int j = i + 1; j < 100; j++)
+            distinct &= fds[i] != fds[j];
+    expect(distinct, "ssfs_fopen handed out a descriptor twice", err_no);
+
+    // the last descriptor works like the first
+    expect(ssfs_fwrite(fds[99], "last", 4) == 4, "fwrite through a descriptor of the grown table failed", err_no);
+    expect(ssfs_fread(fds[9], buf, 4) == 4 && memcmp(buf, "last", 4) == 0, "fread through another descriptor of the file failed", err_no);
+
+    expect(ssfs_fclose(fds[50]) == 0, "ssfs_fclose failed", err_no);
+    expect(ssfs_fclose(fds[50]) < 0, "ssfs_fclose closed a descriptor twice", err_no);
+    expect(ssfs_frseek(fds[50], 0) < 0 && ssfs_fwseek(fds[50], 0) < 0, "seek accepted a closed descriptor", err_no);
+    expect(ssfs_fwrite(fds[50], "x", 1) < 0, "fwrite accepted a closed descriptor", err_no);
+    fd = ssfs_fopen("fd0");
+    expect(fd == fds[50], "the closed descriptor was not handed out again", err_no);
+    expect(ssfs_fclose(-1) < 0 && ssfs_fclose(MAX_FD_ENTRY) < 0 && ssfs_fclose(1000000) < 0, "ssfs_fclose accepted an out of range descriptor", err_no);
+    expect(ssfs_frseek(1000000, 0) < 0 && ssfs_fwseek(-1, 0) < 0, "seek accepted an out of range descriptor", err_no);
+
+    for(int i = 0; i < 100; i++)
+        ssfs_fclose(fds[i]);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Inode allocation: files are created until the inodes run out, the next create
+   fails cleanly, and a removed file's inode is found again, also after a remount.
+ */
+int test_inode_alloc(int *err_no){
+    char name[32];
+    char *data;
+    int created = 0;
+    int inodes;
+    int fd;
+
+    mkssfs(1);
+    inodes = free_inodes();
+    for(int i = 0; i < NUM_INODES + 1; i++) {
+        sprintf(name, "inode%d", i);
+        fd = ssfs_fopen(name);
+        if(fd < 0)
+            break;
+        ssfs_fclose(fd);
+        created++;
+    }
+    expect(created == inodes, "fewer files were created than there were free inodes", err_no);
+
+    // an inode freed in the middle of the table is found again
+    expect(ssfs_remove("inode20") == 0, "ssfs_remove failed", err_no);
+    fd = ssfs_fopen("again");
+    expect(fd >= 0, "the freed inode was not found", err_no);
+    ssfs_fclose(fd);
+    expect(ssfs_fopen("again2") < 0, "a file was created with no inode left", err_no);
+
+    // a file past NUM_POINTERS blocks needs a second inode
+    ssfs_remove("inode21");
+    ssfs_remove("inode22");
+    mkssfs(0);
+    expect(free_inodes() == 2, "the free inodes were not found after a remount", err_no);
+    fd = ssfs_fopen("big");
+    data = calloc((NUM_POINTERS + 1) * 1024, 1);
+    expect(ssfs_fwrite(fd, data, (NUM_POINTERS + 1) * 1024) == (NUM_POINTERS + 1) * 1024, "fwrite needing an indirect inode failed", err_no);
+    expect(ssfs_fwrite(fd, data, NUM_POINTERS * 1024) < (int)(NUM_POINTERS * 1024), "fwrite took an indirect inode that was not there", err_no);
+    free(data);
+    ssfs_fclose(fd);
+    expect(free_inodes() == 0, "the big file did not take both free inodes", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Counts the entries readdir returns for path, -1 when it fails.
+ */
+int count_entries(char *path){
+    char fname[MAX_NAME_LEN + 1];
+    int cookie = 0;
+    int count = 0;
+    int res;
+
+    while((res = ssfs_readdir(path, &cookie, fname)) > 0)
+        count++;
+    return res < 0 ? -1 : count;
+}
+
+/*
+   Directories: nested paths open, list and survive a remount, the error paths of
+   mkdir, rmdir and path lookup fail, entries can be removed while they are listed,
+   and batch and prefix removal reach into subdirectories.
+ */
+int test_directories(int *err_no){
+    char *batch[] = {"a/b/one", "a/two", "a/b/missing", "a/b"};
+    int results[4];
+    char buf[64];
+    char name[32];
+    char fname[MAX_NAME_LEN + 1];
+    char path[MAX_NAME_LEN + 3];
+    int cookie = 0;
+    int listed = 0;
+    int fd;
+
+    mkssfs(1);
+    expect(ssfs_mkdir("a") == 0 && ssfs_mkdir("a/b") == 0 && ssfs_mkdir("/c/") == 0, "ssfs_mkdir failed", err_no);
+    expect(ssfs_mkdir("a") < 0, "ssfs_mkdir created a directory twice", err_no);
+    expect(ssfs_mkdir("missing/d") < 0, "ssfs_mkdir created a directory in a missing one", err_no);
+    expect(ssfs_fopen("missing/file") < 0, "ssfs_fopen created a file in a missing directory", err_no);
+    expect(ssfs_fopen("a") < 0, "ssfs_fopen opened a directory", err_no);
+
+    for(int i = 0; i < 5; i++) {
+        sprintf(name, i < 3 ? "a/b/log%d" : "a/log%d", i);
+        fd = ssfs_fopen(name);
+        ssfs_fwrite(fd, name, strlen(name));
+        ssfs_fclose(fd);
+    }
+    fd = ssfs_fopen("a/b/one");
+    ssfs_fwrite(fd, "one", 3);
+    ssfs_fclose(fd);
+    fd = ssfs_fopen("a/two");
+    ssfs_fclose(fd);
+    fd = ssfs_fopen("b");
+    ssfs_fwrite(fd, "root", 4);
+    ssfs_fclose(fd);
+
+    // the tree survives a remount
+    mkssfs(0);
+    expect(count_entries("a") == 4 && count_entries("a/b") == 4 && count_entries("c") == 0, "readdir lists the wrong entries", err_no);
+    expect(count_entries("b") < 0 && count_entries("nothing") < 0, "readdir listed a file or a missing directory", err_no);
+    fd = ssfs_fopen("/a//b/one");
+    expect(ssfs_fread(fd, buf, 3) == 3 && memcmp(buf, "one", 3) == 0, "a nested file did not read back", err_no);
+    ssfs_fclose(fd);
+    fd = ssfs_fopen("b");
+    expect(ssfs_fread(fd, buf, 4) == 4 && memcmp(buf, "root", 4) == 0, "a root file named like a directory did not read back", err_no);
+    ssfs_fclose(fd);
+
+    expect(ssfs_remove("a/b") < 0, "ssfs_remove removed a directory", err_no);
+    expect(ssfs_rmdir("a/b") < 0, "ssfs_rmdir removed a directory that is not empty", err_no);
+    expect(ssfs_rmdir("b") < 0, "ssfs_rmdir removed a file", err_no);
+    expect(ssfs_rmdir("c") == 0, "ssfs_rmdir failed", err_no);
+
+    // removing the entry just listed keeps the cookie valid
+    ssfs_mkdir("d");
+    for(int i = 0; i < 4; i++) {
+        sprintf(name, "d/f%d", i);
+        ssfs_fclose(ssfs_fopen(name));
+    }
+    while(ssfs_readdir("d", &cookie, fname) > 0) {
+        sprintf(path, "d/%s", fname);
+        listed += ssfs_remove(path) == 0;
+    }
+    expect(listed == 4 && count_entries("d") == 0 && ssfs_rmdir("d") == 0, "removing entries while listing them skipped some", err_no);
+
+    // batch and prefix removal in subdirectories
+    expect(ssfs_remove_batch(batch, 4, results) == 2, "ssfs_remove_batch did not remove 2 nested files", err_no);
+    expect(results[0] == 0 && results[1] == 0 && results[2] == -1 && results[3] == -1, "ssfs_remove_batch gave the wrong results for nested paths", err_no);
+    expect(ssfs_remove_prefix("a/b/log") == 3, "ssfs_remove_prefix did not remove 3 nested files", err_no);
+    expect(ssfs_remove_prefix("nothing/log") < 0, "ssfs_remove_prefix accepted a missing directory", err_no);
+    expect(count_entries("a/b") == 0 && count_entries("a") == 3, "removal in subdirectories left the wrong entries", err_no);
+    expect(ssfs_remove_prefix("a/") == 2, "ssfs_remove_prefix of a whole directory did not remove its 2 files", err_no);
+    expect(ssfs_rmdir("a/b") == 0 && ssfs_rmdir("a") == 0, "ssfs_rmdir of the emptied directories failed", err_no);
+    expect(count_entries("/") == 1, "the root does not hold only the file left", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Root directory: a create or remove writes only the dirent block it changes, and
+   a root filled, thinned out and refilled lists and reads back after a remount.
+ */
+int test_root_dir(int *err_no){
+    ssfs_statfs_t before;
+    ssfs_statfs_t after;
+    char name[32];
+    char buf[32];
+    int created = 0;
+    int fd;
+
+    mkssfs(1);
+    ssfs_fclose(ssfs_fopen("first"));
+
+    // the dirent, name heap and inode blocks, not the super block or the whole region
+    ssfs_statfs(&before);
+    fd = ssfs_fopen("second");
+    ssfs_fclose(fd);
+    ssfs_remove("second");
+    ssfs_statfs(&after);
+    expect(after.ops[SSFS_STAT_FOPEN].metadata_writes - before.ops[SSFS_STAT_FOPEN].metadata_writes <= 3, "a create wrote more than its dirent, name heap and inode blocks", err_no);
+    expect(after.ops[SSFS_STAT_REMOVE].metadata_writes - before.ops[SSFS_STAT_REMOVE].metadata_writes <= 4, "a remove wrote more than its dirent, name heap, inode and bitmap blocks", err_no);
+    ssfs_remove("first");
+
+    for(int i = 0; ; i++) {
+        sprintf(name, "root%d", i);
+        fd = ssfs_fopen(name);
+        if(fd < 0)
+            break;
+        ssfs_fwrite(fd, name, strlen(name));
+        ssfs_fclose(fd);
+        created++;
+    }
+    for(int i = 0; i < created; i += 2) {
+        sprintf(name, "root%d", i);
+        ssfs_remove(name);
+    }
+    for(int i = 0; i < created; i += 2) {
+        sprintf(name, "new%d", i);
+        fd = ssfs_fopen(name);
+        ssfs_fwrite(fd, name, strlen(name));
+        ssfs_fclose(fd);
+    }
+
+    mkssfs(0);
+    expect(count_entries("/") == created, "the refilled root lists the wrong number of entries", err_no);
+    for(int i = 0; i < created; i++) {
+        sprintf(name, i % 2 == 0 ? "new%d" : "root%d", i);
+        fd = ssfs_fopen(name);
+        memset(buf, 0, sizeof(buf));
+        if(!expect(ssfs_fread(fd, buf, strlen(name)) == strlen(name) && strcmp(buf, name) == 0, "a file of the refilled root did not read back", err_no))
+            break;
+        ssfs_fclose(fd);
+    }
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Long names: names up to MAX_NAME_LEN bytes that differ only at the end are
+   distinct files and list in full, a longer one is refused, and creating and
+   removing names over and over does not grow the name table.
+ */
+int test_long_names(int *err_no){
+    char names[3][MAX_NAME_LEN + 2];
+    char fname[MAX_NAME_LEN + 1];
+    int before = 0;
+    char buf[8];
+    int cookie = 0;
+    int found = 0;
+    int fd;
+
+    mkssfs(1);
+    for(int i = 0; i < 3; i++) {
+        memset(names[i], 'n', MAX_NAME_LEN + 1);
+        names[i][MAX_NAME_LEN + 1] = '\0';
+    }
+    names[0][MAX_NAME_LEN] = '\0';
+    names[1][MAX_NAME_LEN] = '\0';
+    names[1][MAX_NAME_LEN - 1] = 'm';
+
+    expect(ssfs_fopen(names[2]) < 0, "ssfs_fopen accepted a name longer than MAX_NAME_LEN", err_no);
+    for(int i = 0; i < 2; i++) {
+        fd = ssfs_fopen(names[i]);
+        if(!expect(fd >= 0, "ssfs_fopen of a MAX_NAME_LEN name failed", err_no))
+            return -1;
+        ssfs_fwrite(fd, i == 0 ? "0" : "1", 1);
+        ssfs_fclose(fd);
+    }
+
+    mkssfs(0);
+    while(ssfs_readdir("/", &cookie, fname) > 0)
+        found += strcmp(fname, names[0]) == 0 || strcmp(fname, names[1]) == 0;
+    expect(found == 2, "readdir did not return both long names in full", err_no);
+    for(int i = 0; i < 2; i++) {
+        fd = ssfs_fopen(names[i]);
+        expect(ssfs_fread(fd, buf, 1) == 1 && buf[0] == '0' + i, "a file with a long name read back the wrong data", err_no);
+        ssfs_fclose(fd);
+    }
+
+    // freed name bytes are reused, the first round sizes the table for ten names
+    for(int round = 0; round < 20; round++) {
+        if(round == 1)
+            before = free_blocks();
+        for(int i = 0; i < 10; i++) {
+            names[2][0] = 'a' + i;
+            names[2][MAX_NAME_LEN - round] = '\0';
+            ssfs_fclose(ssfs_fopen(names[2]));
+        }
+        for(int i = 0; i < 10; i++) {
+            names[2][0] = 'a' + i;
+            ssfs_remove(names[2]);
+        }
+    }
+    expect(free_blocks() == before, "the name table grew while names were created and removed", err_no);
+    expect(ssfs_remove(names[0]) == 0 && ssfs_remove(names[1]) == 0, "removing the long names failed", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Lazy mount: a volume mounted with SSFS_MOUNT_LAZY reads every file back, finds
+   a free inode in a part of the table it has not read yet, releases the blocks of
+   a file it removes, and what it writes is there after a full remount.
+ */
+int test_lazy_mount(int *err_no){
+    char pad[BLOCK_SIZE] = {0};
+    char name[32];
+    char buf[32];
+    int created = 0;
+    int blocks;
+    int fd;
+
+    mkssfs(1);
+    for(int i = 0; ; i++) {
+        sprintf(name, "lazy%d", i);
+        fd = ssfs_fopen(name);
+        if(fd < 0)
+            break;
+        ssfs_fwrite(fd, name, strlen(name));
+        // lazy0 fills a data block, the others are small enough to live in their inodes
+        if(i == 0)
+            ssfs_fwrite(fd, pad, BLOCK_SIZE - strlen(name));
+        ssfs_fclose(fd);
+        created++;
+    }
+    // the last file has one of the last inodes
+    sprintf(name, "lazy%d", created - 1);
+    ssfs_remove(name);
+
+    mkssfs(SSFS_MOUNT_LAZY);
+    fd = ssfs_fopen("late");
+    expect(fd >= 0, "a lazy mount did not find the free inode at the end of the table", err_no);
+    ssfs_fwrite(fd, "late", 4);
+    ssfs_fclose(fd);
+    expect(ssfs_fopen("one more") < 0, "a lazy mount created a file with no inode left", err_no);
+    for(int i = 0; i < created - 1; i++) {
+        sprintf(name, "lazy%d", i);
+        fd = ssfs_fopen(name);
+        memset(buf, 0, sizeof(buf));
+        if(!expect(ssfs_fread(fd, buf, strlen(name)) == strlen(name) && strcmp(buf, name) == 0, "a file did not read back after a lazy mount", err_no))
+            break;
+        ssfs_fclose(fd);
+    }
+    blocks = free_blocks();
+    expect(ssfs_remove("lazy0") == 0, "ssfs_remove after a lazy mount failed", err_no);
+    expect(free_blocks() == blocks + 1, "ssfs_remove after a lazy mount did not release its block", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("late");
+    memset(buf, 0, sizeof(buf));
+    expect(ssfs_fread(fd, buf, 4) == 4 && strcmp(buf, "late") == 0, "a file written after a lazy mount did not read back", err_no);
+    ssfs_fclose(fd);
+    expect(count_entries("/") == created - 1, "a lazy mount left the wrong entries", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Inode cache: files of mixed sizes, some past the direct pointers, keep their
+   contents through a full and a lazy remount, and inodes freed in the cache are
+   handed out again.
+ */
+int test_inode_cache(int *err_no){
+    char name[32];
+    char *data = malloc(20000);
+    char *buf = malloc(20000);
+    int fd;
+    int bad = 0;
+
+    for(int i = 0; i < 20000; i++)
+        data[i] = (char)(i * 7 + i / 251);
+
+    mkssfs(1);
+    for(int i = 0; i < 24; i++) {
+        sprintf(name, "cache%d", i);
+        fd = ssfs_fopen(name);
+        ssfs_fwrite(fd, data + i, i * 777);
+        ssfs_fclose(fd);
+    }
+    // once through a full mount and once through a lazy one
+    for(int round = 0; round < 2; round++) {
+        mkssfs(round == 0 ? 0 : SSFS_MOUNT_LAZY);
+        for(int i = 0; i < 24; i++) {
+            sprintf(name, "cache%d", i);
+            fd = ssfs_fopen(name);
+            if(ssfs_fread(fd, buf, i * 777) != i * 777 || memcmp(buf, data + i, i * 777) != 0)
+                bad++;
+            ssfs_fclose(fd);
+        }
+    }
+    expect(bad == 0, "a file changed size or contents across a remount", err_no);
+
+    for(int i = 0; i < 24; i += 2) {
+        sprintf(name, "cache%d", i);
+        ssfs_remove(name);
+    }
+    for(int i = 0; i < 12; i++) {
+        sprintf(name, "again%d", i);
+        fd = ssfs_fopen(name);
+        if(!expect(fd >= 0, "a freed inode was not handed out again", err_no))
+            break;
+        ssfs_fwrite(fd, data, 3000);
+        ssfs_fclose(fd);
+    }
+    mkssfs(0);
+    bad = 0;
+    for(int i = 1; i < 24; i += 2) {
+        sprintf(name, "cache%d", i);
+        fd = ssfs_fopen(name);
+        if(ssfs_fread(fd, buf, i * 777) != i * 777 || memcmp(buf, data + i, i * 777) != 0)
+            bad++;
+        ssfs_fclose(fd);
+    }
+    expect(bad == 0, "reusing inodes changed the files that were kept", err_no);
+
+    free(data);
+    free(buf);
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Offline checker: a volume with a block marked used that nothing references and
+   a referenced block marked free fails the check with any number of threads, -r
+   repairs both, and a second run finds nothing. A name heap block that is not
+   mapped is reported as left unrepaired and -r keeps the entries naming it.
+ */
+int test_fsck_repair(int *err_no){
+    bitmap_t bitmap;
+    super_block_t sb;
+    char block[BLOCK_SIZE];
+    inode_t *heap;
+    int heap_pointer;
+    char data[5000];
+    int leaked = -1;
+    int missing = -1;
+    int fd;
+
+    memset(data, 'f', sizeof(data));
+    mkssfs(1);
+    fd = ssfs_fopen("checked");
+    ssfs_fwrite(fd, data, sizeof(data));
+    ssfs_fclose(fd);
+    expect(run_fsck("-j 1") == 0 && run_fsck("-j 4") == 0 && run_fsck("-j 64") == 0, "ssfs_fsck failed on a clean volume", err_no);
+
+    read_blocks(NUM_BLOCKS - 1, 1, &bitmap);
+    for(int i = NUM_DATA_BLOCKS - 1; i >= FIRST_DATA_BLOCK && leaked == -1; i--) {
+        if(!((bitmap.bits[i / 32] >> (i % 32)) & 1))
+            leaked = i;
+    }
+    for(int i = FIRST_DATA_BLOCK; i < NUM_DATA_BLOCKS && missing == -1; i++) {
+        if((bitmap.bits[i / 32] >> (i % 32)) & 1)
+            missing = i;
+    }
+    bitmap.bits[leaked / 32] |= 1u << (leaked % 32);
+    bitmap.bits[missing / 32] &= ~(1u << (missing % 32));
+    write_blocks(NUM_BLOCKS - 1, 1, &bitmap);
+
+    expect(run_fsck("-j 1") == 4, "ssfs_fsck -j 1 did not find the damage", err_no);
+    expect(run_fsck("-j 8") == 4, "ssfs_fsck -j 8 did not find the damage", err_no);
+    expect(run_fsck("-r") == 1, "ssfs_fsck -r did not repair the damage", err_no);
+    expect(run_fsck("") == 0, "the damage was still there after ssfs_fsck -r", err_no);
+
+    read_blocks(NUM_BLOCKS - 1, 1, &bitmap);
+    expect(!((bitmap.bits[leaked / 32] >> (leaked % 32)) & 1), "the unreferenced block is still marked used", err_no);
+    expect((bitmap.bits[missing / 32] >> (missing % 32)) & 1, "the referenced block is still marked free", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("checked");
+    memset(data, 0, sizeof(data));
+    expect(ssfs_fread(fd, data, sizeof(data)) == sizeof(data) && data[0] == 'f' && data[sizeof(data) - 1] == 'f', "the file did not survive the repair", err_no);
+    ssfs_fclose(fd);
+
+    // unmap the first name heap block, the names in it are lost until it is mapped again
+    read_blocks(0, 1, block);
+    memcpy(&sb, block, sizeof(sb));
+    read_blocks(sb.inode_start + sb.name_heap / INODES_PER_BLOCK, 1, block);
+    heap = (inode_t *)block + sb.name_heap % INODES_PER_BLOCK;
+    heap_pointer = heap->pointers[0];
+    heap->pointers[0] = -1;
+    write_blocks(sb.inode_start + sb.name_heap / INODES_PER_BLOCK, 1, block);
+    expect(run_fsck("-r") == 4, "ssfs_fsck -r claimed to repair an unmapped name heap block", err_no);
+
+    // mapped again, only the heap block -r freed as unreferenced is left to repair
+    read_blocks(sb.inode_start + sb.name_heap / INODES_PER_BLOCK, 1, block);
+    heap->pointers[0] = heap_pointer;
+    write_blocks(sb.inode_start + sb.name_heap / INODES_PER_BLOCK, 1, block);
+    expect(run_fsck("-r") == 1 && run_fsck("") == 0, "ssfs_fsck -r did not repair the freed name heap block", err_no);
+    mkssfs(0);
+    fd = ssfs_fopen("checked");
+    memset(data, 0, sizeof(data));
+    expect(ssfs_fread(fd, data, sizeof(data)) == sizeof(data) && data[0] == 'f', "ssfs_fsck -r cleared the entries of an unmapped name heap block", err_no);
+    ssfs_fclose(fd);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Clones: ssfs_clone shares every block of the source, a write to either file
+   copies only what it changes, removing the source leaves the clone whole, also
+   for a clone made on a lazy mount, and a missing source or an existing
+   destination is refused.
+ */
+int test_clone(int *err_no){
+    int blocks;
+    char *data = malloc(20000);
+    char *buf = malloc(20000);
+    int fd;
+
+    for(int i = 0; i < 20000; i++)
+        data[i] = (char)(i % 253);
+
+    mkssfs(1);
+    fd = ssfs_fopen("original");
+    ssfs_fwrite(fd, data, 20000);
+    ssfs_fclose(fd);
+
+    blocks = free_blocks();
+    expect(ssfs_clone("original", "copy") == 0, "ssfs_clone failed", err_no);
+    expect(free_blocks() == blocks, "ssfs_clone copied blocks", err_no);
+
+    fd = ssfs_fopen("copy");
+    ssfs_fwseek(fd, 0);
+    ssfs_fwrite(fd, "changed", 7);
+    ssfs_fclose(fd);
+    expect(free_blocks() == blocks - 1, "a write to the clone did not copy exactly one block", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("original");
+    expect(ssfs_fread(fd, buf, 20000) == 20000 && memcmp(buf, data, 20000) == 0, "a write to the clone changed the source", err_no);
+    ssfs_fclose(fd);
+    expect(ssfs_remove("original") == 0, "removing the source of a clone failed", err_no);
+    fd = ssfs_fopen("copy");
+    expect(ssfs_fread(fd, buf, 20000) == 20000 && memcmp(buf, "changed", 7) == 0 && memcmp(buf + 7, data + 7, 20000 - 7) == 0, "the clone did not survive removing its source", err_no);
+    ssfs_fclose(fd);
+
+    expect(ssfs_clone("missing", "other") < 0, "ssfs_clone of a missing file succeeded", err_no);
+    fd = ssfs_fopen("taken");
+    ssfs_fclose(fd);
+    expect(ssfs_clone("copy", "taken") < 0, "ssfs_clone over an existing file succeeded", err_no);
+
+    // a clone on a lazy mount never reads the free bitmap, its share counts still reach the disk
+    mkssfs(SSFS_MOUNT_LAZY);
+    expect(ssfs_clone("copy", "lazy copy") == 0, "ssfs_clone on a lazy mount failed", err_no);
+    mkssfs(0);
+    expect(ssfs_remove("copy") == 0, "removing the source of a lazy clone failed", err_no);
+    memset(buf, 'z', 20000);
+    fd = ssfs_fopen("filler");
+    ssfs_fwrite(fd, buf, 20000);
+    ssfs_fclose(fd);
+    fd = ssfs_fopen("lazy copy");
+    expect(ssfs_fread(fd, buf, 20000) == 20000 && memcmp(buf, "changed", 7) == 0 && memcmp(buf + 7, data + 7, 20000 - 7) == 0, "a clone made on a lazy mount lost its blocks", err_no);
+    ssfs_fclose(fd);
+
+    free(data);
+    free(buf);
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Snapshots: a snapshot taken from a lazy mount shows the files as they were when
+   it was taken, refuses writes but closes descriptors, and deleting it hands back
+   every block that only it was using.
+ */
+int test_snapshot(int *err_no){
+    int blocks;
+    char old_data[5000], new_data[5000], buf[5000];
+    int snapshot;
+    int fd;
+
+    memset(old_data, 'o', sizeof(old_data));
+    memset(new_data, 'n', sizeof(new_data));
+    mkssfs(1);
+    fd = ssfs_fopen("kept");
+    ssfs_fwrite(fd, old_data, sizeof(old_data));
+    ssfs_fclose(fd);
+    ssfs_fclose(ssfs_fopen("empty"));
+    ssfs_fclose(ssfs_fopen("gone later"));
+    blocks = free_blocks();
+
+    // taken from a lazy mount, so the snapshot has to read the metadata it copies
+    mkssfs(SSFS_MOUNT_LAZY);
+    snapshot = ssfs_snapshot();
+    expect(snapshot >= 0, "ssfs_snapshot failed", err_no);
+    fd = ssfs_fopen("kept");
+    ssfs_fwseek(fd, 0);
+    ssfs_fwrite(fd, new_data, sizeof(new_data));
+    ssfs_fclose(fd);
+    ssfs_remove("gone later");
+
+    expect(mkssfs_snapshot(snapshot) == 0, "mkssfs_snapshot failed", err_no);
+    fd = ssfs_fopen("kept");
+    expect(ssfs_fread(fd, buf, sizeof(buf)) == sizeof(buf) && memcmp(buf, old_data, sizeof(buf)) == 0, "the snapshot does not show the old contents", err_no);
+    expect(ssfs_fwrite(fd, new_data, 10) < 0, "a write to a snapshot succeeded", err_no);
+    expect(ssfs_fclose(fd) == 0, "ssfs_fclose on a snapshot failed", err_no);
+    // closing an empty file writes no metadata over the live volume
+    expect(ssfs_fclose(ssfs_fopen("empty")) == 0, "ssfs_fclose of an empty file on a snapshot failed", err_no);
+    expect(ssfs_fopen("new file") < 0, "a file was created in a snapshot", err_no);
+    expect(ssfs_remove("kept") < 0, "a file was removed from a snapshot", err_no);
+    // a refused mount keeps the snapshot that is already mounted, "gone later" is only in the snapshot
+    expect(mkssfs_snapshot(MAX_SNAPSHOTS) < 0, "a snapshot past the table could be mounted", err_no);
+    fd = ssfs_fopen("gone later");
+    expect(fd >= 0, "a refused mkssfs_snapshot replaced the mounted super block", err_no);
+    ssfs_fclose(fd);
+
+    mkssfs(0);
+    fd = ssfs_fopen("kept");
+    expect(ssfs_fread(fd, buf, sizeof(buf)) == sizeof(buf) && memcmp(buf, new_data, sizeof(buf)) == 0, "the live volume does not show the new contents", err_no);
+    ssfs_fclose(fd);
+    expect(ssfs_snapshot_delete(snapshot) == 0, "ssfs_snapshot_delete failed", err_no);
+    expect(free_blocks() == blocks, "deleting the snapshot did not free its blocks", err_no);
+    expect(mkssfs_snapshot(snapshot) < 0, "a deleted snapshot could still be mounted", err_no);
+
+    mkssfs(0);
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Inline data: a file no larger than INLINE_MAX_SIZE lives in its inode and
+   takes no block, each small write costs at most one inode table block, and the
+   file moves out to data blocks once it grows past the limit.
+ */
+int test_inline(int *err_no){
+    ssfs_statfs_t before, after;
+    int blocks;
+    char data[INLINE_MAX_SIZE + 100];
+    char buf[INLINE_MAX_SIZE + 100];
+    int chunk = INLINE_MAX_SIZE / 10;
+    int fd;
+
+    for(int i = 0; i < sizeof(data); i++)
+        data[i] = 'a' + i % 26;
+    mkssfs(1);
+    // the first name takes a name heap block
+    fd = ssfs_fopen("first");
+    ssfs_fclose(fd);
+    ssfs_remove("first");
+
+    blocks = free_blocks();
+    ssfs_statfs(&before);
+    fd = ssfs_fopen("small");
+    for(int i = 0; i < 10; i++)
+        ssfs_fwrite(fd, data + i * chunk, chunk);
+    ssfs_fclose(fd);
+    ssfs_statfs(&after);
+    expect(free_blocks() == blocks, "a small file took a data block", err_no);
+    expect(after.ops[SSFS_STAT_FWRITE].metadata_writes - before.ops[SSFS_STAT_FWRITE].metadata_writes <= 10, "a small write to an inline file wrote more than one metadata block", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("small");
+    memset(buf, 0, sizeof(buf));
+    expect(ssfs_fread(fd, buf, 10 * chunk) == 10 * chunk && memcmp(buf, data, 10 * chunk) == 0, "an inline file did not read back", err_no);
+    ssfs_fwrite(fd, data + 10 * chunk, sizeof(data) - 10 * chunk);
+    ssfs_fclose(fd);
+    expect(free_blocks() == blocks - 1, "a file grown past INLINE_MAX_SIZE did not move to a data block", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("small");
+    memset(buf, 0, sizeof(buf));
+    expect(ssfs_fread(fd, buf, sizeof(data)) == sizeof(data) && memcmp(buf, data, sizeof(data)) == 0, "a file moved out of its inode did not read back", err_no);
+    ssfs_fclose(fd);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Tail packing: the short last blocks of several closed files share one block,
+   a file still open elsewhere keeps its own, every file reads back, and appending
+   to one of them moves its tail out again without touching the others.
+ */
+int test_tails(int *err_no){
+    int blocks;
+    char data[2 * BLOCK_SIZE + 400];
+    char buf[2 * BLOCK_SIZE + 400];
+    char name[32];
+    int size = 2 * BLOCK_SIZE + 200;
+    int bad = 0;
+    int fds[2];
+    int fd;
+
+    for(int i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i * 13);
+    mkssfs(1);
+    // the first name takes a name heap block
+    fd = ssfs_fopen("first");
+    ssfs_fclose(fd);
+    ssfs_remove("first");
+
+    blocks = free_blocks();
+    for(int i = 0; i < 4; i++) {
+        sprintf(name, "tail%d", i);
+        fd = ssfs_fopen(name);
+        ssfs_fwrite(fd, data + i, size);
+        ssfs_fclose(fd);
+    }
+    expect(blocks - free_blocks() == 4 * 2 + 1, "the tails of four files did not share one block", err_no);
+
+    // a file open twice keeps its tail until the last descriptor closes
+    fds[0] = ssfs_fopen("twice");
+    fds[1] = ssfs_fopen("twice");
+    ssfs_fwrite(fds[0], data, BLOCK_SIZE + 100);
+    blocks = free_blocks();
+    ssfs_fclose(fds[0]);
+    expect(free_blocks() == blocks, "a tail was packed while another descriptor had the file open", err_no);
+    ssfs_fclose(fds[1]);
+    expect(free_blocks() == blocks + 1, "the tail was not packed when the last descriptor closed", err_no);
+
+    mkssfs(0);
+    for(int i = 0; i < 4; i++) {
+        sprintf(name, "tail%d", i);
+        fd = ssfs_fopen(name);
+        if(ssfs_fread(fd, buf, size) != size || memcmp(buf, data + i, size) != 0)
+            bad++;
+        ssfs_fclose(fd);
+    }
+    expect(bad == 0, "a file with a packed tail did not read back", err_no);
+
+    fd = ssfs_fopen("tail1");
+    ssfs_fwrite(fd, data + 1 + size, 100);
+    ssfs_fclose(fd);
+    mkssfs(0);
+    bad = 0;
+    for(int i = 0; i < 4; i++) {
+        int length = i == 1 ? size + 100 : size;
+        sprintf(name, "tail%d", i);
+        fd = ssfs_fopen(name);
+        if(ssfs_fread(fd, buf, length) != length || memcmp(buf, data + i, length) != 0)
+            bad++;
+        ssfs_fclose(fd);
+    }
+    expect(bad == 0, "appending to one packed file changed the files sharing its tail block", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Compression: ssfs_fcompress switches an empty file to clusters, compressible
+   data then takes fewer blocks than it would plain, reads and overwrites anywhere
+   in the file work, and a file with data in it is refused.
+ */
+int test_compress(int *err_no){
+    int blocks;
+    char *data = malloc(40000);
+    char *buf = malloc(40000);
+    char *line = "ssfs packs each cluster of sixteen blocks on its own. ";
+    int fd;
+
+    for(int i = 0; i < 40000; i++)
+        data[i] = line[i % strlen(line)];
+    mkssfs(1);
+    // the first name takes a name heap block
+    fd = ssfs_fopen("first");
+    ssfs_fclose(fd);
+    ssfs_remove("first");
+
+    blocks = free_blocks();
+    fd = ssfs_fopen("packed");
+    expect(ssfs_fcompress(fd) == 0, "ssfs_fcompress on an empty file failed", err_no);
+    expect(ssfs_fwrite(fd, data, 40000) == 40000, "a write to a compressed file failed", err_no);
+    ssfs_fclose(fd);
+    expect(blocks - free_blocks() < 40000 / BLOCK_SIZE / 2, "compressible data did not take fewer blocks", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("packed");
+    ssfs_frseek(fd, 20000);
+    expect(ssfs_fread(fd, buf, 300) == 300 && memcmp(buf, data + 20000, 300) == 0, "a read from the middle of a compressed file failed", err_no);
+    memcpy(data + CLUSTER_SIZE - 10, "written across a cluster", 24);
+    ssfs_fwseek(fd, CLUSTER_SIZE - 10);
+    ssfs_fwrite(fd, data + CLUSTER_SIZE - 10, 24);
+    ssfs_fclose(fd);
+
+    mkssfs(0);
+    fd = ssfs_fopen("packed");
+    expect(ssfs_fread(fd, buf, 40000) == 40000 && memcmp(buf, data, 40000) == 0, "an overwrite across clusters did not read back", err_no);
+    expect(ssfs_fcompress(fd) < 0, "ssfs_fcompress on a file with data succeeded", err_no);
+    ssfs_fclose(fd);
+
+    free(data);
+    free(buf);
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Dedup: with ssfs_set_dedup on, a second file holding the same blocks as the
+   first takes no new blocks, and a write to one copy leaves the other as it was.
+ */
+int test_dedup(int *err_no){
+    int blocks;
+    char data[8 * BLOCK_SIZE];
+    char buf[8 * BLOCK_SIZE];
+    int fd;
+
+    for(int i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i / BLOCK_SIZE * 31 + i % 97);
+    mkssfs(1);
+    expect(ssfs_set_dedup(1) == 0, "ssfs_set_dedup failed", err_no);
+    // the first name takes a name heap block
+    fd = ssfs_fopen("first");
+    ssfs_fclose(fd);
+    ssfs_remove("first");
+
+    blocks = free_blocks();
+    fd = ssfs_fopen("one");
+    ssfs_fwrite(fd, data, sizeof(data));
+    ssfs_fclose(fd);
+    fd = ssfs_fopen("two");
+    ssfs_fwrite(fd, data, sizeof(data));
+    ssfs_fclose(fd);
+    expect(blocks - free_blocks() == 8, "identical blocks were not shared", err_no);
+
+    fd = ssfs_fopen("two");
+    ssfs_fwseek(fd, BLOCK_SIZE + 5);
+    ssfs_fwrite(fd, "different", 9);
+    ssfs_fclose(fd);
+
+    mkssfs(0);
+    fd = ssfs_fopen("one");
+    expect(ssfs_fread(fd, buf, sizeof(buf)) == sizeof(buf) && memcmp(buf, data, sizeof(buf)) == 0, "a write to one copy changed the other", err_no);
+    ssfs_fclose(fd);
+    memcpy(data + BLOCK_SIZE + 5, "different", 9);
+    fd = ssfs_fopen("two");
+    expect(ssfs_fread(fd, buf, sizeof(buf)) == sizeof(buf) && memcmp(buf, data, sizeof(buf)) == 0, "a write to a shared block did not read back", err_no);
+    ssfs_fclose(fd);
+    ssfs_set_dedup(0);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Dedup and clones: a file deduplicated onto one block many times clones while
+   that block can take the new owners, the clone keeps its data once the source
+   is gone, and a clone that would give the block more than MAX_BLOCK_SHARES
+   owners is refused without changing anything.
+ */
+int test_dedup_clone(int *err_no){
+    char *zeros = calloc(200, BLOCK_SIZE);
+    char *buf = malloc(200 * BLOCK_SIZE);
+    char other[BLOCK_SIZE];
+    int blocks;
+    int fd;
+
+    memset(other, 'x', sizeof(other));
+    mkssfs(1);
+    ssfs_set_dedup(1);
+
+    // 100 owners of one block, the clone brings it to 200
+    fd = ssfs_fopen("hundred");
+    ssfs_fwrite(fd, zeros, 100 * BLOCK_SIZE);
+    ssfs_fclose(fd);
+    expect(ssfs_clone("hundred", "hundred.clone") == 0, "cloning a deduplicated file failed", err_no);
+    expect(ssfs_remove("hundred") == 0, "removing the source of the clone failed", err_no);
+    fd = ssfs_fopen("other");
+    ssfs_fwrite(fd, other, BLOCK_SIZE);
+    ssfs_fclose(fd);
+    fd = ssfs_fopen("hundred.clone");
+    expect(ssfs_fread(fd, buf, 100 * BLOCK_SIZE) == 100 * BLOCK_SIZE && memcmp(buf, zeros, 100 * BLOCK_SIZE) == 0, "the clone of a deduplicated file lost its data", err_no);
+    ssfs_fclose(fd);
+    ssfs_remove("hundred.clone");
+    ssfs_remove("other");
+
+    // 200 owners of one block, a clone would take it past MAX_BLOCK_SHARES
+    fd = ssfs_fopen("zeros");
+    ssfs_fwrite(fd, zeros, 200 * BLOCK_SIZE);
+    ssfs_fclose(fd);
+    blocks = free_blocks();
+    expect(ssfs_clone("zeros", "zeros.clone") < 0, "a clone past MAX_BLOCK_SHARES owners succeeded", err_no);
+    expect(free_blocks() == blocks && file_is_gone("zeros.clone"), "a refused clone changed the volume", err_no);
+    expect(ssfs_remove("zeros") == 0, "removing the deduplicated file failed", err_no);
+    fd = ssfs_fopen("other");
+    ssfs_fwrite(fd, other, BLOCK_SIZE);
+    ssfs_fclose(fd);
+    ssfs_set_dedup(0);
+
+    free(zeros);
+    free(buf);
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Defragmenting: files appended to in turn end up interleaved on the disk,
+   ssfs_defrag makes them contiguous again, reports what it did, and every file,
+   a clone sharing the blocks of one of them included, keeps its contents.
+ */
+int test_defrag(int *err_no){
+    ssfs_defrag_stats_t stats;
+    char data[3][12 * BLOCK_SIZE];
+    char buf[12 * BLOCK_SIZE];
+    char name[32];
+    int moved;
+    int bad = 0;
+    int fd;
+
+    for(int f = 0; f < 3; f++)
+        for(int i = 0; i < sizeof(data[f]); i++)
+            data[f][i] = (char)(f * 41 + i % 251);
+    mkssfs(1);
+    for(int b = 0; b < 12; b++) {
+        for(int f = 0; f < 3; f++) {
+            sprintf(name, "frag%d", f);
+            fd = ssfs_fopen(name);
+            ssfs_fwrite(fd, data[f] + b * BLOCK_SIZE, BLOCK_SIZE);
+            ssfs_fclose(fd);
+        }
+    }
+    expect(ssfs_frag_score() > 0, "files appended to in turn are not fragmented", err_no);
+    // the clone shares every block of frag0, so moving one has to keep both files whole
+    ssfs_clone("frag0", "frag0.clone");
+
+    memset(&stats, 0, sizeof(stats));
+    moved = ssfs_defrag(0, &stats);
+    expect(moved > 0 && stats.blocks_moved == moved && stats.files_moved > 0, "ssfs_defrag did not report what it moved", err_no);
+    expect(stats.score_after < stats.score_before && stats.score_after == ssfs_frag_score(), "ssfs_defrag did not lower the fragmentation score", err_no);
+
+    mkssfs(0);
+    for(int f = 0; f < 3; f++) {
+        sprintf(name, "frag%d", f);
+        fd = ssfs_fopen(name);
+        if(ssfs_fread(fd, buf, sizeof(buf)) != sizeof(buf) || memcmp(buf, data[f], sizeof(buf)) != 0)
+            bad++;
+        ssfs_fclose(fd);
+    }
+    fd = ssfs_fopen("frag0.clone");
+    if(ssfs_fread(fd, buf, sizeof(buf)) != sizeof(buf) || memcmp(buf, data[0], sizeof(buf)) != 0)
+        bad++;
+    ssfs_fclose(fd);
+    expect(bad == 0, "a file changed when it was defragmented", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Block placement: two files appended to in turn through open descriptors each
+   get contiguous blocks from their own window, a file allocated meanwhile stays
+   out of the windows, and closing them gives back what the windows held, so the
+   next file is contiguous as well.
+ */
+int test_alloc_windows(int *err_no){
+    ssfs_statfs_t after;
+    int blocks;
+    char data[BLOCK_SIZE];
+    int fds[3];
+    int score;
+
+    memset(data, 'w', sizeof(data));
+    mkssfs(1);
+    // the first name takes a name heap block
+    fds[0] = ssfs_fopen("first");
+    ssfs_fclose(fds[0]);
+    ssfs_remove("first");
+
+    blocks = free_blocks();
+    fds[0] = ssfs_fopen("left");
+    fds[1] = ssfs_fopen("right");
+    for(int b = 0; b < 12; b++) {
+        ssfs_fwrite(fds[0], data, BLOCK_SIZE);
+        ssfs_fwrite(fds[1], data, BLOCK_SIZE);
+        // a file allocated meanwhile takes its blocks from outside the windows
+        if(b == 3) {
+            fds[2] = ssfs_fopen("between");
+            ssfs_fallocate(fds[2], 0, BLOCK_SIZE);
+            ssfs_fclose(fds[2]);
+        }
+    }
+    // a file only breaks where it outgrows a window, without them every step would
+    score = ssfs_frag_score();
+    expect(score <= 100 / ALLOC_WINDOW, "files appended to in turn through open descriptors are fragmented", err_no);
+    ssfs_fclose(fds[0]);
+    ssfs_fclose(fds[1]);
+
+    ssfs_statfs(&after);
+    expect(after.open_files == 0, "descriptors are still counted as open", err_no);
+    expect(blocks - free_blocks() == 24 + 1, "closed descriptors kept blocks", err_no);
+    fds[0] = ssfs_fopen("after");
+    for(int b = 0; b < 12; b++)
+        ssfs_fwrite(fds[0], data, BLOCK_SIZE);
+    ssfs_fclose(fds[0]);
+    expect(ssfs_frag_score() < score, "a file written after the windows were closed is fragmented", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Sparse files: a write past the end leaves a hole that reads as zeros and takes
+   no blocks, a read stops at the end of the file, and ssfs_flseek finds where
+   data and holes start.
+ */
+int test_sparse(int *err_no){
+    int blocks;
+    char data[BLOCK_SIZE];
+    char buf[11 * BLOCK_SIZE];
+    int zeros = 1;
+    int fd;
+
+    memset(data, 's', sizeof(data));
+    mkssfs(1);
+    // the first name takes a name heap block
+    fd = ssfs_fopen("first");
+    ssfs_fclose(fd);
+    ssfs_remove("first");
+
+    blocks = free_blocks();
+    fd = ssfs_fopen("sparse");
+    ssfs_fwrite(fd, data, BLOCK_SIZE);
+    expect(ssfs_fwseek(fd, 10 * BLOCK_SIZE) == 0, "ssfs_fwseek past the end failed", err_no);
+    expect(ssfs_fwrite(fd, data, BLOCK_SIZE) == BLOCK_SIZE, "a write past the end failed", err_no);
+    ssfs_fclose(fd);
+    expect(blocks - free_blocks() == 2, "a hole took blocks", err_no);
+
+    mkssfs(0);
+    fd = ssfs_fopen("sparse");
+    expect(ssfs_fread(fd, buf, sizeof(buf)) == sizeof(buf), "a sparse file did not read to its end", err_no);
+    for(int i = BLOCK_SIZE; i < 10 * BLOCK_SIZE; i++)
+        zeros &= buf[i] == 0;
+    expect(zeros, "a hole did not read as zeros", err_no);
+    expect(memcmp(buf, data, BLOCK_SIZE) == 0 && memcmp(buf + 10 * BLOCK_SIZE, data, BLOCK_SIZE) == 0, "the data around a hole did not read back", err_no);
+    ssfs_frseek(fd, 10 * BLOCK_SIZE + 10);
+    expect(ssfs_fread(fd, buf, BLOCK_SIZE) == BLOCK_SIZE - 10, "a read past the end was not cut at the end of the file", err_no);
+
+    expect(ssfs_flseek(fd, 0, SSFS_SEEK_DATA) == 0, "SSFS_SEEK_DATA did not find the first block", err_no);
+    expect(ssfs_flseek(fd, 0, SSFS_SEEK_HOLE) == BLOCK_SIZE, "SSFS_SEEK_HOLE did not find the hole", err_no);
+    expect(ssfs_flseek(fd, BLOCK_SIZE + 10, SSFS_SEEK_DATA) == 10 * BLOCK_SIZE, "SSFS_SEEK_DATA did not skip the hole", err_no);
+    expect(ssfs_flseek(fd, 10 * BLOCK_SIZE, SSFS_SEEK_HOLE) == 11 * BLOCK_SIZE, "SSFS_SEEK_HOLE did not stop at the end", err_no);
+    expect(ssfs_flseek(fd, 12 * BLOCK_SIZE, SSFS_SEEK_DATA) < 0, "ssfs_flseek past the end succeeded", err_no);
+    ssfs_fclose(fd);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Statistics: ssfs_statfs counts the calls, errors and bytes of every measured
+   operation, and ssfs_stats_export with no interval appends one JSON object per
+   operation to its file.
+ */
+int test_statfs(int *err_no){
+    ssfs_statfs_t before, after;
+    char path[] = "/tmp/ssfs_stats.XXXXXX";
+    char data[3000];
+    char line[8192];
+    int lines = 0;
+    int well_formed = 1;
+    FILE *f;
+    int fd;
+
+    memset(data, 'c', sizeof(data));
+    mkssfs(1);
+    // the first name takes a name heap block
+    fd = ssfs_fopen("first");
+    ssfs_fclose(fd);
+    ssfs_remove("first");
+
+    ssfs_statfs(&before);
+    fd = ssfs_fopen("counted");
+    for(int i = 0; i < 3; i++)
+        ssfs_fwrite(fd, data, 1000);
+    ssfs_frseek(fd, 0);
+    ssfs_fread(fd, data, 2500);
+    ssfs_fwrite(-1, data, 10);
+    ssfs_fclose(fd);
+    ssfs_statfs(&after);
+
+    expect(after.ops[SSFS_STAT_FOPEN].calls - before.ops[SSFS_STAT_FOPEN].calls == 1, "ssfs_fopen was not counted", err_no);
+    expect(after.ops[SSFS_STAT_FWRITE].calls - before.ops[SSFS_STAT_FWRITE].calls == 4, "ssfs_fwrite calls were not counted", err_no);
+    expect(after.ops[SSFS_STAT_FWRITE].errors - before.ops[SSFS_STAT_FWRITE].errors == 1, "a failed ssfs_fwrite was not counted", err_no);
+    expect(after.ops[SSFS_STAT_FWRITE].bytes - before.ops[SSFS_STAT_FWRITE].bytes == 3000, "the bytes written were not counted", err_no);
+    expect(after.ops[SSFS_STAT_FREAD].bytes - before.ops[SSFS_STAT_FREAD].bytes == 2500, "the bytes read were not counted", err_no);
+    expect(after.ops[SSFS_STAT_FRSEEK].calls - before.ops[SSFS_STAT_FRSEEK].calls == 1, "ssfs_frseek was not counted", err_no);
+    expect(after.ops[SSFS_STAT_FWRITE].blocks_written > before.ops[SSFS_STAT_FWRITE].blocks_written, "the blocks written were not counted", err_no);
+    expect(after.total_inodes == NUM_INODES && after.free_inodes == before.free_inodes - 1 && after.open_files == 0, "ssfs_statfs reported the wrong usage", err_no);
+    expect(after.free_blocks == free_blocks() && after.free_inodes == free_inodes(), "ssfs_statfs does not match the free bitmap and inode table", err_no);
+
+    // the dirent block of a subdirectory sits in the data region but is still metadata
+    ssfs_mkdir("dir");
+    ssfs_statfs(&before);
+    ssfs_fclose(ssfs_fopen("dir/made"));
+    ssfs_statfs(&after);
+    expect(after.ops[SSFS_STAT_FOPEN].blocks_written > before.ops[SSFS_STAT_FOPEN].blocks_written, "a create in a subdirectory wrote nothing", err_no);
+    expect(after.ops[SSFS_STAT_FOPEN].metadata_writes - before.ops[SSFS_STAT_FOPEN].metadata_writes == after.ops[SSFS_STAT_FOPEN].blocks_written - before.ops[SSFS_STAT_FOPEN].blocks_written, "a create in a subdirectory wrote blocks not counted as metadata", err_no);
+
+    close(mkstemp(path));
+    expect(ssfs_stats_export(path, 0) == 0, "ssfs_stats_export failed", err_no);
+    fd = ssfs_fopen("counted");
+    ssfs_fread(fd, data, 100);
+    ssfs_fclose(fd);
+    expect(ssfs_stats_export(NULL, 0) == 0, "stopping ssfs_stats_export failed", err_no);
+    fd = ssfs_fopen("not exported");
+    ssfs_fclose(fd);
+
+    f = fopen(path, "r");
+    while(f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        lines++;
+        well_formed &= line[0] == '{' && strstr(line, "\"free_blocks\": ") != NULL && strstr(line, "\"fread\": {\"calls\": ") != NULL && strcmp(line + strlen(line) - 3, "}}\n") == 0;
+    }
+    if(f != NULL)
+        fclose(f);
+    unlink(path);
+    expect(lines == 3, "ssfs_stats_export did not write a line when it started and after each operation", err_no);
+    expect(well_formed, "ssfs_stats_export wrote a line that is not a stats object", err_no);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Counts the lines of the file at path holding needle, -1 if it cannot be read.
+ */
+int count_in_file(char *path, char *needle){
+    char line[1024];
+    int count = 0;
+    FILE *f = fopen(path, "r");
+
+    if(f == NULL)
+        return -1;
+    while(fgets(line, sizeof(line), f) != NULL)
+        count += strstr(line, needle) != NULL;
+    fclose(f);
+    return count;
+}
+
+/*
+   Tracing: with ssfs_trace on, every call records a begin and an end event and
+   the disk transfers inside it record their blocks; ssfs_trace_dump writes them as
+   a Chrome trace. Nothing is recorded while tracing is off.
+ */
+int test_trace(int *err_no){
+    char path[] = "/tmp/ssfs_trace.XXXXXX";
+    char data[2000];
+    int opens, writes;
+    int fd;
+
+    memset(data, 't', sizeof(data));
+    mkssfs(1);
+    close(mkstemp(path));
+    ssfs_trace(0);
+    expect(ssfs_trace_dump(path) == 0, "ssfs_trace_dump failed", err_no);
+    opens = count_in_file(path, "\"name\": \"ssfs_fopen\", \"ph\": \"B\"");
+    writes = count_in_file(path, "\"name\": \"ssfs_fwrite\", \"ph\": \"B\"");
+    fd = ssfs_fopen("untraced");
+    ssfs_fwrite(fd, data, sizeof(data));
+    ssfs_fclose(fd);
+    ssfs_trace_dump(path);
+    expect(count_in_file(path, "\"name\": \"ssfs_fopen\", \"ph\": \"B\"") == opens, "ssfs_fopen was traced with tracing off", err_no);
+
+    ssfs_trace(1);
+    fd = ssfs_fopen("traced");
+    ssfs_fwrite(fd, data, sizeof(data));
+    ssfs_fwrite(fd, data, sizeof(data));
+    ssfs_fclose(fd);
+    ssfs_trace(0);
+    expect(ssfs_trace_dump(path) == 0, "ssfs_trace_dump failed", err_no);
+    expect(count_in_file(path, "\"name\": \"ssfs_fopen\", \"ph\": \"B\"") == opens + 1 && count_in_file(path, "\"name\": \"ssfs_fopen\", \"ph\": \"E\"") == opens + 1, "ssfs_fopen was not traced", err_no);
+    expect(count_in_file(path, "\"name\": \"ssfs_fwrite\", \"ph\": \"B\"") == writes + 2 && count_in_file(path, "\"name\": \"ssfs_fwrite\", \"ph\": \"E\"") == writes + 2, "ssfs_fwrite was not traced", err_no);
+    expect(count_in_file(path, "\"name\": \"disk_write\", \"ph\": \"B\"") > 0 && count_in_file(path, "\"args\": {\"block\": ") > 0, "the disk writes were not traced with their blocks", err_no);
+    expect(count_in_file(path, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [") == 1 && count_in_file(path, "]}") == 1, "ssfs_trace_dump did not write a trace object", err_no);
+    unlink(path);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
+
+/*
+   Benchmark: ssfs_bench ($SSFS_BENCH or ./ssfs_bench) writes its results as one
+   JSON object, leaves the volume in the current directory alone and removes the
+   temporary directory it ran in.
+ */
+int test_bench(int *err_no){
+    char tmp_dir[] = "/tmp/ssfs_bench_test.XXXXXX";
+    char output[] = "/tmp/ssfs_bench_out.XXXXXX";
+    char command[1024];
+    char *bench = getenv("SSFS_BENCH");
+    char buf[100];
+    int res;
+    int fd;
+
+    mkssfs(1);
+    fd = ssfs_fopen("mine");
+    ssfs_fwrite(fd, "still here", 10);
+    ssfs_fclose(fd);
+
+    close(mkstemp(output));
+    mkdtemp(tmp_dir);
+    snprintf(command, sizeof(command), "TMPDIR=%s %s -r 1 -o %s", tmp_dir, bench != NULL ? bench : "./ssfs_bench", output);
+    fflush(stdout);
+    res = system(command);
+    expect(res != -1 && WIFEXITED(res) && WEXITSTATUS(res) == 0, "ssfs_bench failed", err_no);
+    expect(count_in_file(output, "{\"benchmark\": \"ssfs_bench\", ") == 1 && count_in_file(output, "{\"name\": \"seq_write\", ") > 0, "ssfs_bench did not write its results", err_no);
+    expect(rmdir(tmp_dir) == 0, "ssfs_bench left files in its temporary directory", err_no);
+    unlink(output);
+
+    mkssfs(0);
+    fd = ssfs_fopen("mine");
+    memset(buf, 0, sizeof(buf));
+    expect(ssfs_fread(fd, buf, sizeof(buf)) == 10 && strcmp(buf, "still here") == 0, "ssfs_bench changed the volume in the current directory", err_no);
+    ssfs_fclose(fd);
+
+    test_fsck(err_no);
+    printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+    test_num++;
+    return 0;
+}
@@ -7,7 +7,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <pthread.h>
 #include "sfs_api.h"
+#include "disk_emu.h"
 
 /* The maximum file name length. We assume that filenames can contain
  * upper-case letters and periods ('.') characters. Feel free to
@@ -67,3 +69,36 @@ int test_persistence(int *error, int write_length);
 
 //Help functionn
 int free_name_element(char **name_list, int num_file);
+
+//Feature tests, each formats a fresh volume and runs ssfs_fsck over it at the end
+int expect(int cond, char *what, int *err_no);
+int test_fsck(int *err_no);
+int run_fsck(char *options);
+int free_blocks();
+int free_inodes();
+int test_async(int *err_no);
+int test_mmap(int *err_no);
+int test_fallocate(int *err_no);
+int test_ftruncate(int *err_no);
+int test_remove_batch(int *err_no);
+int test_fd_table(int *err_no);
+int test_inode_alloc(int *err_no);
+int test_directories(int *err_no);
+int test_root_dir(int *err_no);
+int test_long_names(int *err_no);
+int test_lazy_mount(int *err_no);
+int test_inode_cache(int *err_no);
+int test_fsck_repair(int *err_no);
+int test_clone(int *err_no);
+int test_snapshot(int *err_no);
+int test_inline(int *err_no);
+int test_tails(int *err_no);
+int test_compress(int *err_no);
+int test_dedup(int *err_no);
+int test_dedup_clone(int *err_no);
+int test_defrag(int *err_no);
+int test_alloc_windows(int *err_no);
+int test_sparse(int *err_no);
+int test_statfs(int *err_no);
+int test_trace(int *err_no);
+int test_bench(int *err_no);